@@ -0,0 +1,220 @@
+#include "slist.h"
+#include "slist_parallel.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Runs one independent context per thread and reports how the total
+// throughput scales with the number of threads, then compares the cost
+// of preparing a fresh context with forking a prepared one, and how
+// parsing a large source scales with the threads of a pool and with the
+// kernels of the structural scanner.
+
+namespace
+{
+    const char *prelude =
+        "(define (fib n)"
+        "    (if (< n 2)"
+        "        n"
+        "        (+ (fib (- n 1)) (fib (- n 2)))))"
+        "(define (count-up n acc)"
+        "    (if (= n 0)"
+        "        acc"
+        "        (count-up (- n 1) (cons n acc))))";
+
+    const char *workload = "(begin (fib 15) (length (count-up 200 '())))";
+
+    double run_threads(unsigned thread_count, int iterations);
+    void worker(int iterations, std::atomic<bool>& ready);
+    void compare_startup(int iterations);
+    void compare_parse(unsigned max_threads);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 200;
+    unsigned max_threads = std::thread::hardware_concurrency();
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--iterations") == 0) && i + 1 < argc)
+        {
+            iterations = std::atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) && i + 1 < argc)
+        {
+            max_threads = static_cast<unsigned>(std::atoi(argv[++i]));
+        }
+    }
+
+    if (max_threads == 0)
+    {
+        max_threads = 1;
+    }
+
+    std::cout << "threads  evals/s      speedup  efficiency" << std::endl;
+
+    double base = 0;
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+    {
+        double throughput = run_threads(threads, iterations);
+        if (threads == 1)
+        {
+            base = throughput;
+        }
+
+        double speedup = throughput / base;
+        std::cout << threads << "\t "
+                  << static_cast<long>(throughput) << "\t      "
+                  << speedup << "\t"
+                  << (speedup / threads) * 100 << "%" << std::endl;
+
+        if (threads < max_threads && threads * 2 > max_threads)
+        {
+            threads = max_threads / 2;
+        }
+    }
+
+    compare_startup(iterations);
+    compare_parse(max_threads);
+
+    return 0;
+}
+
+namespace
+{
+    double run_threads(unsigned thread_count, int iterations)
+    {
+        std::atomic<bool> ready(false);
+        std::vector<std::thread> threads;
+
+        for (unsigned i = 0; i < thread_count; ++i)
+        {
+            threads.emplace_back(worker, iterations, std::ref(ready));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        ready = true;
+
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return (thread_count * iterations) / elapsed.count();
+    }
+
+    void worker(int iterations, std::atomic<bool>& ready)
+    {
+        using namespace slist;
+
+        // Each thread owns its context and output, nothing is shared
+        auto out = std::make_shared<string_sink>();
+        context ctx;
+        ctx.log.out = out;
+        ctx.log.err = out;
+
+        exec(ctx, prelude);
+        node_ptr program = parse(workload);
+
+        while (!ready)
+        {
+            std::this_thread::yield();
+        }
+
+        for (int i = 0; i < iterations; ++i)
+        {
+            eval(ctx, program->car);
+        }
+    }
+
+    void compare_startup(int iterations)
+    {
+        using namespace slist;
+
+        auto out = std::make_shared<string_sink>();
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            context ctx;
+            ctx.log.out = out;
+            exec(ctx, prelude);
+        }
+        std::chrono::duration<double, std::micro> fresh = std::chrono::steady_clock::now() - start;
+
+        context prepared;
+        prepared.log.out = out;
+        exec(prepared, prelude);
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            context ctx = prepared.fork();
+        }
+        std::chrono::duration<double, std::micro> forked = std::chrono::steady_clock::now() - start;
+
+        std::cout << std::endl
+                  << "startup  us/context" << std::endl
+                  << "fresh\t " << fresh.count() / iterations << std::endl
+                  << "fork\t " << forked.count() / iterations << std::endl;
+    }
+
+    void compare_parse(unsigned max_threads)
+    {
+        using namespace slist;
+
+        std::string source;
+        for (int i = 0; i < 400000; ++i)
+        {
+            source += "(record " + std::to_string(i) + " \"name (" + std::to_string(i) + ")\" 2.5 '(a b c)) ; note\n";
+        }
+
+        std::cout << std::endl << "source   " << source.size() / (1024.0 * 1024.0) << " MB" << std::endl;
+        std::cout << "threads  parse ms" << std::endl;
+
+        auto start = std::chrono::steady_clock::now();
+        parse(source);
+        std::chrono::duration<double, std::milli> sequential = std::chrono::steady_clock::now() - start;
+        std::cout << "parse\t " << sequential.count() << std::endl;
+
+        start = std::chrono::steady_clock::now();
+        parse_data(source.data(), source.size());
+        std::chrono::duration<double, std::milli> data = std::chrono::steady_clock::now() - start;
+        std::cout << "data\t " << data.count() << std::endl;
+
+        for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+        {
+            context ctx;
+            ctx.pool = std::make_shared<thread_pool>(threads);
+
+            start = std::chrono::steady_clock::now();
+            parse_parallel(ctx, source.data(), source.size());
+            std::chrono::duration<double, std::milli> parallel = std::chrono::steady_clock::now() - start;
+            std::cout << threads << "\t " << parallel.count() << std::endl;
+
+            if (threads < max_threads && threads * 2 > max_threads)
+            {
+                threads = max_threads / 2;
+            }
+        }
+
+        const char *kernel_names[] = { "scalar", "sse2", "avx2" };
+        std::cout << std::endl << "kernel   scan MB/s" << std::endl;
+
+        std::vector<structural> index;
+        for (int kernel = 0; kernel <= static_cast<int>(best_scan_kernel()); ++kernel)
+        {
+            start = std::chrono::steady_clock::now();
+            scan_structure(source.data(), source.size(), static_cast<scan_kernel>(kernel), index);
+            std::chrono::duration<double> scan = std::chrono::steady_clock::now() - start;
+            std::cout << kernel_names[kernel] << "\t " << source.size() / scan.count() / 1e6 << std::endl;
+        }
+    }
+}
@@ -4,6 +4,14 @@
 #include "slist_types.h"
 #include "slist_context.h"
 #include "slist_parser.h"
+#include "slist_scan.h"
 #include "slist_eval.h"
 #include "slist_log.h"
+#include "slist_sink.h"
+#include "slist_image.h"
+#include "slist_cache.h"
+#include "slist_file.h"
+#include "slist_observer.h"
+#include "slist_trace.h"
+#include "slist_serialize.h"
 #endif
\ No newline at end of file
@@ -0,0 +1,18 @@
+#ifndef SLIST_CACHE_H
+#define SLIST_CACHE_H
+
+#include "slist_types.h"
+
+namespace slist
+{
+	// Parses 'source' like 'parse', reusing the tree stored in 'cache_dir'
+	// by a previous call with the same source.  Entries are named after a
+	// hash of the source and of the runtime version, hold the whole source,
+	// which must match for the tree to be used, and are written atomically
+	// so that processes can share the directory.  The cache is only an
+	// optimization: when it cannot be read or written, the source is parsed.
+	node_ptr parse_cached(const std::string& source, const std::string& cache_dir);
+	node_ptr parse_cached(const char *source, size_t size, const std::string& cache_dir);
+}
+
+#endif
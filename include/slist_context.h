@@ -1,38 +1,189 @@
 #ifndef SLIST_CONTEXT_H
 #define SLIST_CONTEXT_H
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <unordered_set>
 
 #include "slist_types.h"
+#include "slist_log.h"
+#include "slist_trace.h"
 
 namespace slist
 {
+	class thread_pool;
+	struct eval_observer;
+	struct constant_pool;
+
+	// A context shares no mutable state with other contexts: separate
+	// contexts can be used concurrently from separate threads.  A single
+	// context must only be used by one thread at a time.
 	struct context
 	{
 		context();
 
+		// Evaluates in an existing global environment, without registering
+		// the builtins again.  Used by the workers of parallel builtins.
+		explicit context(const environment_ptr& global_env);
+
+		// Returns a context sharing the global definitions of this one,
+		// with a copy of its symbols.  'define' and 'set!' in the fork
+		// write to its own global environment and never affect this
+		// context.  This context must not be modified while its forks are
+		// in use.
+		context fork() const;
+
+		// The native receives the unevaluated expression and must evaluate
+		// each argument itself
 		void     register_native(const std::string& name, procedure::callback func);
+
+		// The native receives the expression with its arguments already
+		// evaluated, and must not evaluate them again
+		void     register_function(const std::string& name, procedure::callback func);
+
+		void     register_special_form(const std::string& name, opcode form);
+
+		// Called when the name of the special form 'form' is bound to
+		// something else, in any environment.  The evaluator then looks
+		// the name up instead of dispatching on the tag of the node.
+		void     shadow_special_form(opcode form);
+
 		node_ptr lookup_symbol(const std::string& name);
 		void     insert_symbol(const node_ptr& node);
 
+		// Returns the symbol already interned with the name of 'node', or
+		// interns 'node' and returns it
+		node_ptr intern_symbol(const node_ptr& node);
+
 		environment_ptr global_env;
 		environment_ptr active_env;
 
 		typedef std::unordered_map<std::string, node_ptr> symbols_map;
 		symbols_map symbols;
 
-		struct callstack_item
+		// Workers of the parallel builtins look symbols up in the table of
+		// their parent, which waits for them, then in this one.  It is
+		// shared by the workers of a call and merged into the parent's
+		// table once they are done.
+		struct shared_symbols_map
+		{
+			std::mutex lock;
+			symbols_map symbols;
+		};
+		std::shared_ptr<shared_symbols_map> worker_symbols;
+
+		// Bit per shadowed opcode, shared with the forks and the workers of
+		// this context: a binding made by any of them disables the direct
+		// dispatch for all, which is only slower
+		std::shared_ptr<std::atomic<uint32_t>> shadowed_forms;
+
+		// Continuation frame of the evaluator.  Pending computations live
+		// here instead of on the C stack.
+		struct frame
+		{
+			enum class kind
+			{
+				call_operator,  // Evaluating the operator of 'root'
+				call_arguments, // Evaluating 'pending' arguments of 'root'
+				macro_expand,   // Evaluating a macro body, result is evaluated in 'env'
+				branch,         // Evaluating the predicate of an 'if'
+				sequence,       // Evaluating a 'begin', 'pending' holds the next expressions
+				bind,           // Evaluating a 'define' value, 'pending' holds the name
+				assign,         // Evaluating a 'set!' value, 'pending' holds the name
+				bindings,       // Evaluating 'let'/'letrec' values into 'target'
+				quote_list,     // Copying the quoted list 'pending' into 'head'
+				force_promise,  // Evaluating the expression of the promise 'root'
+				stream_cons,    // Evaluating the head of the 'stream-cons' 'root'
+				memo_store,     // Calling a memoized 'proc_node' with 'pending' arguments
+			};
+
+			kind type;
+			node_ptr root;
+			node_ptr pending;
+			node_ptr head;
+			node_ptr tail;
+			node_ptr proc_node;
+			environment_ptr env;
+			environment_ptr target;
+		};
+
+		typedef std::vector<frame> frame_vector;
+		frame_vector frames;
+
+		// Calls seen by the observer or the trace that did not return yet,
+		// with the number of frames when they were made: a call returns
+		// once a value is computed with no more frames than that.  Kept
+		// apart from the frames, which it would make deeper.
+		struct pending_call
 		{
-			node_ptr node;
-			procedure_ptr delayed_proc;
-			node_ptr delayed_args;
+			size_t depth;
+			node_ptr proc_node;
 		};
+		std::vector<pending_call> pending_calls;
+
+		// Environments of finished calls that nothing captured, reused by
+		// the next calls instead of allocating new ones
+		std::vector<environment_ptr> free_environments;
+
+		// Quoted lists without unquote, built once by this context and
+		// returned by every evaluation of the same quote
+		std::shared_ptr<constant_pool> constants;
+
+		// Memory budget of the evaluation stack, in bytes
+		size_t stack_size_limit;
+
+		// Natives registered with 'register_native' call 'eval' recursively,
+		// which does use the C stack.  This limits the nesting.
+		int nesting_level;
+		int nesting_limit;
+
+		// Limits of each evaluation started by the host, checked at
+		// procedure calls.  0 means no limit.
+		size_t fuel_limit; // Number of procedure calls
+		std::chrono::steady_clock::duration time_limit;
+
+		// Stops the running evaluation with an 'evaluation_interrupted'
+		// error.  Can be called from any thread.
+		void interrupt();
+
+		// State of the limits of the running evaluation
+		size_t fuel_left;
+		size_t check_countdown; // Calls before checking the limits again
+		std::chrono::steady_clock::time_point deadline;
+		std::unique_ptr<std::atomic<bool>> interrupt_requested;
+
+		// Worker contexts of the parallel builtins follow the limits of
+		// the context running the builtin
+		const context *parent;
+
+		// Directory caching the parse trees of the sources given to 'exec'
+		// as streams or buffers, none if empty.  Strings, usually short
+		// snippets, are always parsed.
+		std::string parse_cache_dir;
+
+		// Logging and output of this context, initialized from the calling
+		// thread's settings
+		log_settings log;
+
+		// Pool running 'pmap', 'pfor-each' and 'preduce', owned by the host.
+		// Without a pool, they run sequentially.
+		std::shared_ptr<thread_pool> pool;
+
+		// Number of list items per parallel task, 0 for automatic
+		size_t parallel_chunk_size;
+
+		// Notified of the evaluation steps and calls, none by default.
+		// Not inherited by forks and parallel workers.
+		std::shared_ptr<eval_observer> observer;
 
-		typedef std::vector<callstack_item> callstack_vector;
-		callstack_vector callstack;
+		// Last calls and returns, dumped when an evaluation fails.  Each
+		// context has its own, forks included; workers of the parallel
+		// builtins have none.  Null disables the tracing.
+		std::shared_ptr<trace_buffer> trace;
 
 		void debug_dump_callstack();
 	};
 }
 
-#endif
\ No newline at end of file
+#endif
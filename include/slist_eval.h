@@ -3,16 +3,88 @@
 
 #include "slist_types.h"
 #include "slist_context.h"
+#include <chrono>
 #include <string>
 #include <istream>
+#include <stdexcept>
 
 namespace slist
 {
+	// Thrown when the evaluation stack exceeds 'context::stack_size_limit'
+	// or when natives nest deeper than 'context::nesting_limit'
+	struct stack_overflow_error : public std::runtime_error
+	{
+		explicit stack_overflow_error(const std::string& what) : std::runtime_error(what) {}
+	};
+
+	// Thrown when an evaluation exceeds 'context::fuel_limit' or
+	// 'context::time_limit', or is stopped by 'context::interrupt'
+	struct evaluation_interrupted : public std::runtime_error
+	{
+		enum class reason
+		{
+			fuel,
+			deadline,
+			interrupt,
+		};
+
+		evaluation_interrupted(reason cause, const std::string& what) : std::runtime_error(what), cause(cause) {}
+
+		reason cause;
+	};
+
 	node_ptr eval(context& ctx, const node_ptr& n);
+
+	// Calls the procedure with already evaluated arguments
 	node_ptr eval_procedure(context& ctx, const node_ptr& proc_node, const node_ptr& args);
+
+	// Calls the procedure with unevaluated arguments
 	node_ptr apply(context& ctx, const node_ptr& args, const node_ptr& proc_node);
+
+	// Returns the value of a promise, evaluating it the first time only.
+	// Other nodes are returned as is.
+	node_ptr force(context& ctx, const node_ptr& n);
+
+	// Evaluation of a program run by slices with 'run_for'.  Between
+	// slices, its pending computations are kept here, on the heap.
+	struct evaluation
+	{
+		evaluation();
+
+		bool is_done;
+		node_ptr result; // Value of the last form, once done
+
+		// Suspended state of the evaluator
+		node_ptr forms; // Top-level forms not started yet
+		node_ptr expr;
+		environment_ptr env;
+		node_ptr value;
+		bool has_value;
+		context::frame_vector frames;
+		std::vector<context::pending_call> pending_calls; // Depths relative to the first frame
+	};
+	typedef std::shared_ptr<evaluation> evaluation_ptr;
+
+	// Starts evaluating the forms of 'program', as returned by 'parse', and
+	// returns after 'max_steps' steps of the evaluator or 'max_time', or
+	// when done.  0 means no limit.  Natives calling 'eval' run to
+	// completion within a step.  The context limits apply to each slice.
+	evaluation_ptr run_for(context& ctx, const node_ptr& program, size_t max_steps,
+	                       std::chrono::steady_clock::duration max_time = std::chrono::steady_clock::duration::zero());
+
+	// Continues a suspended evaluation, returns true when it is done.  An
+	// error thrown by the evaluation ends it.
+	bool run_for(context& ctx, const evaluation_ptr& e, size_t max_steps,
+	             std::chrono::steady_clock::duration max_time = std::chrono::steady_clock::duration::zero());
+
+	// Evaluates the forms of a source in order, each one as soon as it is
+	// read, and returns the value of the last one.  Streams are read as the
+	// evaluation goes, unless their parse tree is cached: streams and
+	// buffers use 'context::parse_cache_dir', strings never do.  The output
+	// of the context is flushed at the end.
 	node_ptr exec(context& ctx, const std::string& str);
+	node_ptr exec(context& ctx, const char *data, size_t size);
 	node_ptr exec(context& ctx, std::istream& in);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,42 @@
+#ifndef SLIST_FILE_H
+#define SLIST_FILE_H
+
+#include <string>
+#include <vector>
+
+namespace slist
+{
+	// How a mapped file will be read, given to the system as a hint
+	enum class file_access
+	{
+		normal,     // Any order, like an image decoded on demand
+		sequential, // Read once from start to end, like a source being parsed
+	};
+
+	// Read-only view of a whole file.  The file is memory-mapped where
+	// supported, and read into memory otherwise.
+	class mapped_file
+	{
+	public:
+		mapped_file();
+		~mapped_file();
+
+		bool open(const std::string& path, file_access access = file_access::normal);
+		void close();
+
+		const char *data() const { return begin; }
+		size_t size() const { return length; }
+
+	private:
+		mapped_file(const mapped_file&);
+		mapped_file& operator=(const mapped_file&);
+
+		const char *begin;
+		size_t length;
+		bool is_mapped;
+
+		std::vector<char> buffer; // When the file could not be mapped
+	};
+}
+
+#endif
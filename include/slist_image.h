@@ -0,0 +1,83 @@
+#ifndef SLIST_IMAGE_H
+#define SLIST_IMAGE_H
+
+#include "slist_types.h"
+#include "slist_file.h"
+
+#include <cstdint>
+
+namespace slist
+{
+	// Writes the global environment of the context, every value reachable
+	// from it and the interned symbols to 'path'.  Objects refer to each
+	// other by index, so the image does not depend on where it is loaded.
+	bool dump_image(context& ctx, const std::string& path);
+
+	// Maps the image at 'path' and binds its globals in the context.
+	// Values are decoded on first use, once every record of the image is
+	// checked: a corrupted image leaves the context unchanged.  Natives are
+	// linked by name to the ones registered in the context, which must be
+	// registered before.
+	bool load_image(context& ctx, const std::string& path);
+
+	// Image loaded in a global environment, decoding the bindings that
+	// are looked up
+	struct image
+	{
+		image();
+
+		bool open(context& ctx, const std::string& path);
+
+		// Decodes the value bound to 'name', if the image binds it
+		bool take(const std::string& name, node_ptr& value);
+
+		// Decodes every binding that is not in 'bindings' yet
+		void take_all(std::unordered_map<std::string, node_ptr>& bindings);
+
+	private:
+		struct cursor
+		{
+			bool read(uint8_t& value);
+			bool read(uint32_t& value);
+			bool read(std::string& value);
+
+			const char *p;
+			const char *end;
+		};
+
+		bool object_cursor(uint32_t ref, cursor& c) const;
+
+		// Checks the records of every object and the type of the objects
+		// they refer to, so that a corrupted image is rejected as a whole
+		// before anything is decoded lazily
+		bool validate(const char *symbols, uint32_t symbol_count) const;
+		bool validate_object(uint32_t ref) const;
+		bool is_ref(uint32_t ref, uint8_t t1, uint8_t t2 = 0) const;
+
+		node_ptr get_node(uint32_t ref);
+		procedure_ptr get_procedure(uint32_t ref);
+		environment_ptr get_environment(uint32_t ref);
+		promise_ptr get_promise(uint32_t ref);
+		void fill_pending();
+		bool fill(uint32_t ref);
+
+		mapped_file file;
+		const char *offsets; // Offset of each object from 'objects'
+		const char *objects;
+		uint32_t object_count;
+
+		std::unordered_map<std::string, uint32_t> bindings;
+
+		// Decoded objects by index, so that shared objects stay shared
+		std::vector<node_ptr> nodes;
+		std::vector<procedure_ptr> procedures;
+		std::vector<environment_ptr> environments;
+		std::vector<promise_ptr> promises;
+		std::vector<uint32_t> pending; // Created but not filled yet
+
+		std::unordered_map<std::string, procedure_ptr> natives;
+		std::weak_ptr<environment> global_env;
+	};
+}
+
+#endif
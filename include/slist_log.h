@@ -2,17 +2,16 @@
 #define SLIST_LOG_H
 
 #include "slist_types.h"
+#include "slist_sink.h"
 
-#ifdef DEBUG
-#define LOG_TRACE(STR) log_trace_slow(STR)
-#define LOG_TRACE2(STR, ARG0) log_trace_slow(STR, ARG0)
-#define LOG_TRACELN(STR) log_traceln_slow(STR)
-#define LOG_TRACELN2(STR, ARG0) log_traceln_slow(STR, ARG0)
-#else
-#define LOG_TRACE(STR) do {} while (0)
-#define LOG_TRACE2(STR, ARG0) do {} while (0)
-#define LOG_TRACELN(STR) do {} while (0)
-#define LOG_TRACELN2(STR, ARG0) do {} while (0)
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+// Most verbose level compiled in: logs above it are removed at compile
+// time, e.g. 1 keeps errors only.  Output is never removed.
+#ifndef SLIST_MAX_LOG_LEVEL
+#define SLIST_MAX_LOG_LEVEL 3
 #endif
 
 namespace slist
@@ -25,20 +24,116 @@ namespace slist
 		trace   = 3
 	};
 
+	// Logging and output settings.  Each context owns its own, so contexts
+	// running on different threads share no mutable logging state.
+	struct log_settings
+	{
+		log_settings();
+
+		log_level level;
+		output_sink_ptr out; // Output and traces, stdout_sink() by default
+		output_sink_ptr err; // Errors and warnings, stderr_sink() by default
+	};
+
+	// Makes 'settings' the ones used by the logging functions on the
+	// calling thread, until the scope is destroyed.  Contexts do this
+	// while they evaluate, so logs go to the evaluating context.
+	struct log_scope
+	{
+		explicit log_scope(log_settings& settings);
+		~log_scope();
+
+		log_settings *prev;
+	};
+
+	// Level of the active settings.  Outside of any scope, this is the
+	// calling thread's default, which new contexts start from.
 	log_level get_log_level();
 	void set_log_level(log_level level);
 
+	// Writes out what the active output sink holds, as before reading
+	// input or handing the output over to other code
+	void flush_output();
+
 	void output(const std::string& str = "", node_ptr n = nullptr, procedure_ptr f = nullptr, bool from_print = false);
 	void outputln(const std::string& str = "", node_ptr n = nullptr, procedure_ptr f = nullptr, bool from_print = false);
 
-	void log_warning(const std::string& str = "", node_ptr n = nullptr, procedure_ptr f = nullptr);
-	void log_warningln(const std::string& str = "", node_ptr n = nullptr, procedure_ptr f = nullptr);
+	// True when logs of 'level' are compiled in and kept by the active
+	// settings
+	bool is_log_enabled(log_level level);
+
+	// Writes a formatted log to the sink of its level
+	void write_log(log_level level, const std::string& text);
+
+	// Formatting of the arguments of the logging functions: strings as
+	// they are, values as printed, procedures with their variables, body
+	// and environment, and numbers in decimal.
+	void log_append(std::string& out, const std::string& str);
+	void log_append(std::string& out, const char *str);
+	void log_append(std::string& out, std::nullptr_t);
+	void log_append(std::string& out, const node_ptr& n);
+	void log_append(std::string& out, const procedure_ptr& f);
+
+	template <typename T>
+	typename std::enable_if<std::is_arithmetic<T>::value>::type log_append(std::string& out, T value)
+	{
+		out += std::to_string(value);
+	}
+
+	inline void log_format(std::string& out)
+	{
+	}
+
+	template <typename T, typename... Args>
+	void log_format(std::string& out, const T& first, const Args&... rest)
+	{
+		log_append(out, first);
+		log_format(out, rest...);
+	}
+
+	// Formats and writes a log, only when its level is enabled: arguments
+	// are not converted to text otherwise
+	template <typename... Args>
+	void log_at(log_level level, bool is_line, const Args&... args)
+	{
+		if (static_cast<int>(level) > SLIST_MAX_LOG_LEVEL || !is_log_enabled(level))
+		{
+			return;
+		}
+
+		std::string text;
+		log_format(text, args...);
+		if (is_line)
+		{
+			text += '\n';
+		}
+		write_log(level, text);
+	}
+
+	// Logs the concatenation of their arguments, such as
+	// log_errorln("Invalid index: ", index, " in ", root)
+	template <typename... Args>
+	void log_warning(const Args&... args) { log_at(log_level::warning, false, args...); }
+	template <typename... Args>
+	void log_warningln(const Args&... args) { log_at(log_level::warning, true, args...); }
+
+	template <typename... Args>
+	void log_error(const Args&... args) { log_at(log_level::error, false, args...); }
+	template <typename... Args>
+	void log_errorln(const Args&... args) { log_at(log_level::error, true, args...); }
 
-	void log_error(const std::string& str = "", node_ptr n = nullptr, procedure_ptr f = nullptr);
-	void log_errorln(const std::string& str = "", node_ptr n = nullptr, procedure_ptr f = nullptr);
+	// Appends the printed form of 'n' to 'out', without quotes around
+	// strings when 'from_print' is true.  Lists are printed with an explicit
+	// stack, so the length and depth of a value are only limited by memory.
+	// Pairs met again while they are being printed are labelled, as in
+	// "#0=(1 . #0#)".
+	void write_node(std::string& out, const node_ptr& n, bool from_print = false);
+	std::string to_string(const node_ptr& n, bool from_print = false);
 
-	void log_trace_slow(const std::string& str = "", node_ptr n = nullptr, procedure_ptr f = nullptr);
-	void log_traceln_slow(const std::string& str = "", node_ptr n = nullptr, procedure_ptr f = nullptr);
+	template <typename... Args>
+	void log_trace_slow(const Args&... args) { log_at(log_level::trace, false, args...); }
+	template <typename... Args>
+	void log_traceln_slow(const Args&... args) { log_at(log_level::trace, true, args...); }
 }
 
 #endif
\ No newline at end of file
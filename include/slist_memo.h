@@ -0,0 +1,53 @@
+#ifndef SLIST_MEMO_H
+#define SLIST_MEMO_H
+
+#include "slist_types.h"
+
+#include <atomic>
+#include <list>
+#include <mutex>
+
+namespace slist
+{
+	// Cache of a procedure wrapped by 'memoize'.  Arguments are compared
+	// structurally, like 'equal?', and copied when stored so that mutating
+	// them later leaves the cache intact.  When 'capacity' is not 0, the
+	// least recently used entries are evicted.  The cache is locked, so
+	// memoized procedures can be called from the workers of the parallel
+	// builtins.
+	struct memo_cache
+	{
+		memo_cache(const node_ptr& target, size_t capacity);
+
+		bool lookup(const node_ptr& args, node_ptr& value);
+		void insert(const node_ptr& args, const node_ptr& value);
+		size_t size() const;
+
+		node_ptr target;
+		size_t capacity;
+
+		std::atomic<size_t> hits;
+		std::atomic<size_t> misses;
+
+	private:
+		struct key_hash
+		{
+			size_t operator()(const node_ptr& n) const;
+		};
+
+		struct key_equal
+		{
+			bool operator()(const node_ptr& n1, const node_ptr& n2) const;
+		};
+
+		typedef std::pair<node_ptr, node_ptr> entry;
+		typedef std::list<entry> entry_list;
+		typedef std::unordered_map<node_ptr, entry_list::iterator, key_hash, key_equal> entry_map;
+
+		mutable std::mutex lock; // Of 'entries' and 'index'
+		entry_list entries;      // Most recently used first
+		entry_map index;
+	};
+}
+
+#endif
@@ -1,32 +1,31 @@
 #ifndef SLIST_NATIVE_H
 #define SLIST_NATIVE_H
 
-#include "slist_types.H"
+#include "slist_types.h"
 
 namespace slist
 {
     struct context;
-    
-    node_ptr native_eval      (context& ctx, const node_ptr& root); 
-    node_ptr native_apply     (context& ctx, const node_ptr& root);
+
+    // Structural equality used by 'equal?', and a hash consistent with it
+    bool   native_equal_helper(node_ptr arg1, node_ptr arg2);
+    size_t native_hash_helper(node_ptr n);
+
     node_ptr native_cons      (context& ctx, const node_ptr& root);
     node_ptr native_list      (context& ctx, const node_ptr& root);
     node_ptr native_car       (context& ctx, const node_ptr& root);
     node_ptr native_cdr       (context& ctx, const node_ptr& root);
-    node_ptr native_quote     (context& ctx, const node_ptr& root);
     node_ptr native_unquote   (context& ctx, const node_ptr& root);
-    node_ptr native_lambda    (context& ctx, const node_ptr& root);
-    node_ptr native_define    (context& ctx, const node_ptr& root);
-    node_ptr native_defmacro  (context& ctx, const node_ptr& root);
-    node_ptr native_set       (context& ctx, const node_ptr& root);
-    node_ptr native_let       (context& ctx, const node_ptr& root);
-    node_ptr native_letrec    (context& ctx, const node_ptr& root);
-    node_ptr native_begin     (context& ctx, const node_ptr& root);
-    node_ptr native_if        (context& ctx, const node_ptr& root);
     node_ptr native_length    (context& ctx, const node_ptr& root);
     node_ptr native_empty     (context& ctx, const node_ptr& root);
+    node_ptr native_reverse_inplace (context& ctx, const node_ptr& root);
+    node_ptr native_append_inplace  (context& ctx, const node_ptr& root);
+    node_ptr native_list_copy       (context& ctx, const node_ptr& root);
     node_ptr native_print     (context& ctx, const node_ptr& root);
     node_ptr native_println   (context& ctx, const node_ptr& root);
+    node_ptr native_flush     (context& ctx, const node_ptr& root);
+    node_ptr native_to_string (context& ctx, const node_ptr& root);
+    node_ptr native_write_string    (context& ctx, const node_ptr& root);
     node_ptr native_eq        (context& ctx, const node_ptr& root);
     node_ptr native_equal     (context& ctx, const node_ptr& root); 
     node_ptr native_not       (context& ctx, const node_ptr& root);
@@ -48,6 +47,23 @@ namespace slist
     node_ptr native_le        (context& ctx, const node_ptr& root);
     node_ptr native_ge        (context& ctx, const node_ptr& root); 
     node_ptr native_assert    (context& ctx, const node_ptr& root);
+
+    node_ptr native_make_promise  (context& ctx, const node_ptr& root);
+    node_ptr native_is_promise    (context& ctx, const node_ptr& root);
+    node_ptr native_stream_car    (context& ctx, const node_ptr& root);
+    node_ptr native_stream_map    (context& ctx, const node_ptr& root);
+    node_ptr native_stream_filter (context& ctx, const node_ptr& root);
+    node_ptr native_stream_take   (context& ctx, const node_ptr& root);
+
+    node_ptr native_memoize       (context& ctx, const node_ptr& root);
+    node_ptr native_memoize_stats (context& ctx, const node_ptr& root);
+
+    node_ptr native_pmap          (context& ctx, const node_ptr& root);
+    node_ptr native_pfor_each     (context& ctx, const node_ptr& root);
+    node_ptr native_preduce       (context& ctx, const node_ptr& root);
+
+    node_ptr native_serialize     (context& ctx, const node_ptr& root);
+    node_ptr native_deserialize   (context& ctx, const node_ptr& root);
 }
 
 #endif
\ No newline at end of file
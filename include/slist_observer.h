@@ -0,0 +1,47 @@
+#ifndef SLIST_OBSERVER_H
+#define SLIST_OBSERVER_H
+
+#include "slist_types.h"
+
+namespace slist
+{
+	// Notified by the evaluator of the context it is attached to with
+	// 'context::observer', for tracers, debuggers and profilers.  Without
+	// an observer or a trace, each hook costs a branch; the trace attached
+	// by default also records each call.  Building with SLIST_NO_OBSERVERS
+	// defined removes the hooks completely.
+	//
+	// Hooks run on the evaluating thread, and must not evaluate in the
+	// context they observe.
+	struct eval_observer
+	{
+		virtual ~eval_observer() {}
+
+		// 'expr' is about to be evaluated in 'env'
+		virtual void on_enter(context& ctx, const node_ptr& expr, const environment_ptr& env) {}
+
+		// The procedure 'proc_node' is called with 'args', evaluated
+		// unless it is a native registered with 'register_native'
+		virtual void on_call(context& ctx, const node_ptr& proc_node, const node_ptr& args) {}
+
+		// Same as 'on_call', for a call in tail position: it replaces the
+		// call that was running, which gets no 'on_exit'
+		virtual void on_tail_call(context& ctx, const node_ptr& proc_node, const node_ptr& args) {}
+
+		// The last procedure called by an 'on_call' activation, possibly
+		// through tail calls, returns 'value'.  Not called when the
+		// evaluation fails with an exception.
+		virtual void on_exit(context& ctx, const node_ptr& proc_node, const node_ptr& value) {}
+	};
+
+	// Logs every hook at the trace level
+	struct trace_observer : public eval_observer
+	{
+		void on_enter(context& ctx, const node_ptr& expr, const environment_ptr& env) override;
+		void on_call(context& ctx, const node_ptr& proc_node, const node_ptr& args) override;
+		void on_tail_call(context& ctx, const node_ptr& proc_node, const node_ptr& args) override;
+		void on_exit(context& ctx, const node_ptr& proc_node, const node_ptr& value) override;
+	};
+}
+
+#endif
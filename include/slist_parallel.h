@@ -0,0 +1,68 @@
+#ifndef SLIST_PARALLEL_H
+#define SLIST_PARALLEL_H
+
+#include "slist_types.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace slist
+{
+	// Work-stealing thread pool.  Each worker owns a queue: it takes its
+	// own tasks from the back and, when empty, steals from the front of
+	// the other queues.  The pool is created by the host and shared by
+	// contexts through 'context::pool'.
+	class thread_pool
+	{
+	public:
+		typedef std::function<void()> task;
+
+		// 0 threads means one per hardware thread
+		explicit thread_pool(size_t thread_count = 0);
+		~thread_pool();
+
+		size_t size() const;
+
+		// Runs all the tasks and returns when they are complete.  The
+		// calling thread takes part in the work.  The first exception
+		// thrown by a task is rethrown here.
+		void run(std::vector<task>& tasks);
+
+	private:
+		struct queue
+		{
+			std::mutex mutex;
+			std::deque<task> tasks;
+		};
+
+		bool pop(size_t index, task& t);
+		bool steal(size_t index, task& t);
+		void worker(size_t index);
+
+		std::vector<std::unique_ptr<queue>> queues;
+		std::vector<std::thread> threads;
+
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::atomic<size_t> queued;
+		std::atomic<size_t> next;
+		bool is_stopping;
+	};
+
+	// Calls 'func' on consecutive ranges of [0, count).  When the context
+	// has a pool, ranges of 'context::parallel_chunk_size' items run
+	// concurrently, each in a worker context sharing the global
+	// environment of 'ctx'.  Otherwise, 'func' is called once in 'ctx'.
+	typedef std::function<void(context&, size_t begin, size_t end)> range_callback;
+	void parallel_for(context& ctx, size_t count, const range_callback& func);
+
+	// Same result as 'parse'.  When the context has a pool and the source
+	// is large, it is split at top-level forms and the ranges are parsed
+	// concurrently, then joined in order.
+	node_ptr parse_parallel(context& ctx, const char *data, size_t size);
+}
+
+#endif
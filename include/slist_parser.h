@@ -3,12 +3,56 @@
 
 #include "slist_types.h"
 
+#include <functional>
+
 namespace slist
 {
+	// Returns a list of the forms of the source, nullptr on syntax errors
 	node_ptr parse(const std::string& str);
+	node_ptr parse(const char *data, size_t size);
 	node_ptr parse_stream(std::istream& in);
 	node_ptr parse_file(const std::string& filename);
 
+	// Same result as 'parse', in two passes suited to large data files: a
+	// structural index of the source is built first with the best SIMD
+	// kernel of the processor, then the nodes are made from the index.
+	node_ptr parse_data(const char *data, size_t size);
+
+	// Offsets cutting the source into ranges of whole top-level forms, of
+	// at least 'chunk_size' bytes but the last one.  The first offset is 0
+	// and the last one is where 'parse' stops reading.  Parsing the ranges
+	// separately gives the forms of the whole source.
+	std::vector<size_t> split_forms(const char *data, size_t size, size_t chunk_size);
+
+	// Reads the top-level forms of a source one at a time, so that each
+	// can be evaluated and released before the next one is read.  Streams
+	// are read in chunks: memory depends on the largest form, not on the
+	// length of the source.
+	class form_reader
+	{
+	public:
+		form_reader(const char *data, size_t size);
+		explicit form_reader(std::istream& in);
+		explicit form_reader(int fd);
+
+		// Returns false at the end of the source, or on a syntax error
+		bool next(node_ptr& form);
+		bool failed() const;
+
+	private:
+		form_reader(const form_reader&);
+		form_reader& operator=(const form_reader&);
+
+		void fill();
+
+		std::function<size_t(char *, size_t)> source; // Empty for a buffer
+		std::string buffer;
+		const char *p; // Unread part of the source
+		const char *end;
+		bool is_eof;
+		bool has_failed;
+	};
+
 	void print_parse_node(const node_ptr& root);
 	void debug_print_parse_node(const node_ptr& root);
 }
@@ -0,0 +1,38 @@
+#ifndef SLIST_SCAN_H
+#define SLIST_SCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace slist
+{
+	// Instruction sets of the structural scanner
+	enum class scan_kernel
+	{
+		scalar,
+		sse2,
+		avx2,
+	};
+
+	// Best kernel supported by the processor running the program
+	scan_kernel best_scan_kernel();
+
+	// Element of a source found by the scanner: a parenthesis, a quote
+	// before a datum, a string with its double quotes, or a token.  The
+	// first character tells which.
+	struct structural
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	// Builds the structural index of a source, 64 bytes at a time: the
+	// kernel classifies the characters of a block into bit masks, and
+	// tokens, strings and comments are skipped by searching the masks.
+	// Whitespace and comments are not indexed.  Returns false for sources
+	// of 4 GB or more.
+	bool scan_structure(const char *data, size_t size, scan_kernel kernel, std::vector<structural>& index);
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef SLIST_SERIALIZE_H
+#define SLIST_SERIALIZE_H
+
+#include "slist_types.h"
+
+namespace slist
+{
+	struct context;
+
+	// Appends the binary encoding of 'value' to 'out': integers are
+	// varints, numbers varints of their digits or raw doubles, strings and
+	// symbols length-prefixed, symbols written once then referred to by
+	// number, lists by their count and items, and pairs shared within the
+	// value, cycles included, written once.  Returns false for procedures
+	// and promises, which cannot be encoded.
+	bool serialize(const node_ptr& value, std::string& out);
+
+	// Decodes a value written by 'serialize', with its symbols interned in
+	// 'ctx'.  The data is only read, so it can be a mapped file.  Returns
+	// false on malformed data.
+	bool deserialize(context& ctx, const char *data, size_t size, node_ptr& value);
+	bool deserialize(context& ctx, const std::string& data, node_ptr& value);
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef SLIST_SINK_H
+#define SLIST_SINK_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace slist
+{
+	// Destination of the output and logs of a context
+	class output_sink
+	{
+	public:
+		virtual ~output_sink();
+
+		virtual void write(const char *data, size_t size) = 0;
+		virtual void flush();
+	};
+
+	typedef std::shared_ptr<output_sink> output_sink_ptr;
+
+	// Sink gathering writes in a buffer, passed on when it is full, on
+	// 'flush' and on destruction.  When line buffered, as in interactive
+	// use, it is also passed on after each newline.  Writes are locked, so
+	// contexts on several threads can share a sink.
+	class buffered_sink : public output_sink
+	{
+	public:
+		explicit buffered_sink(size_t capacity = 64 * 1024, bool is_line_buffered = false);
+
+		void write(const char *data, size_t size) override;
+		void flush() override;
+
+		void set_line_buffered(bool value);
+
+	protected:
+		// Derived sinks must call 'flush' in their destructor, while
+		// 'write_through' can still be called
+		virtual void write_through(const char *data, size_t size) = 0;
+
+	private:
+		std::mutex lock;
+		std::string buffer;
+		size_t capacity;
+		bool is_line_buffered;
+	};
+
+	// Writes to a file descriptor, which stays open
+	class fd_sink : public buffered_sink
+	{
+	public:
+		explicit fd_sink(int fd, size_t capacity = 64 * 1024, bool is_line_buffered = false);
+		~fd_sink();
+
+	protected:
+		void write_through(const char *data, size_t size) override;
+
+	private:
+		int fd;
+	};
+
+	// Passes the output on to a function
+	class callback_sink : public buffered_sink
+	{
+	public:
+		typedef std::function<void(const char *data, size_t size)> callback;
+
+		explicit callback_sink(callback func, size_t capacity = 64 * 1024, bool is_line_buffered = false);
+		~callback_sink();
+
+	protected:
+		void write_through(const char *data, size_t size) override;
+
+	private:
+		callback func;
+	};
+
+	// Gathers the output in a string
+	class string_sink : public output_sink
+	{
+	public:
+		void write(const char *data, size_t size) override;
+
+		std::string str() const;
+		void clear();
+
+	private:
+		mutable std::mutex lock;
+		std::string text;
+	};
+
+	// Sinks of the process' standard output and error, shared by the
+	// contexts that do not set their own.  The output is line buffered when
+	// it is a terminal, and the errors always are.
+	const output_sink_ptr& stdout_sink();
+	const output_sink_ptr& stderr_sink();
+}
+
+#endif
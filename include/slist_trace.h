@@ -0,0 +1,115 @@
+#ifndef SLIST_TRACE_H
+#define SLIST_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define SLIST_TRACE_TSC
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define SLIST_TRACE_TSC
+#endif
+
+namespace slist
+{
+	struct context;
+
+	enum class trace_event : uint8_t
+	{
+		call,
+		tail_call,
+		native_call,
+		exit,
+	};
+
+	struct trace_entry
+	{
+		std::chrono::steady_clock::time_point time;
+		uint32_t proc_id; // 'procedure::id' of the procedure called or returning
+		trace_event event;
+	};
+
+	// Time of the trace entries: the time stamp counter of the processor
+	// where there is one, much cheaper to read than steady_clock
+	inline int64_t trace_ticks()
+	{
+#ifdef SLIST_TRACE_TSC
+		return static_cast<int64_t>(__rdtsc());
+#else
+		return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+	}
+
+	// Ring of the last calls and returns of a context, written by the
+	// evaluating thread only.  Reading needs no lock and can be done from
+	// any thread, while the context evaluates: entries being overwritten
+	// are left out.
+	class trace_buffer
+	{
+	public:
+		static const size_t default_capacity = 1024;
+
+		// The capacity is rounded up to a power of two
+		explicit trace_buffer(size_t capacity = default_capacity);
+
+		size_t capacity() const { return mask + 1; }
+
+		void record(trace_event event, uint32_t proc_id)
+		{
+			// Each slot is a sequence lock: readers check that its number
+			// did not change while they read it
+			uint64_t index = next.load(std::memory_order_relaxed);
+			slot& s = slots[index & mask];
+			s.number.store(0, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			s.time.store(trace_ticks(), std::memory_order_relaxed);
+			s.data.store((static_cast<uint64_t>(proc_id) << 8) | static_cast<uint8_t>(event), std::memory_order_relaxed);
+			s.number.store(index + 1, std::memory_order_release);
+			next.store(index + 1, std::memory_order_release);
+		}
+
+		// Entries still held, oldest first
+		std::vector<trace_entry> entries() const;
+
+		// Number of entries recorded since the creation of the buffer
+		uint64_t count() const { return next.load(std::memory_order_acquire); }
+
+	private:
+		trace_buffer(const trace_buffer&);
+		trace_buffer& operator=(const trace_buffer&);
+
+		struct slot
+		{
+			std::atomic<uint64_t> number; // Entry index + 1 once written, 0 while written
+			std::atomic<int64_t> time;    // trace_ticks()
+			std::atomic<uint64_t> data;   // Procedure id, then event in the low byte
+		};
+
+		// Converts ticks to times, from the ticks elapsed since then
+		int64_t start_ticks;
+		std::chrono::steady_clock::time_point start_time;
+
+		std::unique_ptr<slot[]> slots;
+		uint64_t mask;
+		std::atomic<uint64_t> next;
+	};
+
+	// Formats the last 'max_entries' entries of the trace of 'ctx', oldest
+	// first, with times relative to the first one.  Procedures bound in the
+	// global environment are shown by name, others by number.  Naming
+	// walks the bindings without a lock: unlike 'trace_buffer::entries',
+	// this must only be called from the thread using 'ctx'.
+	std::string format_trace(const context& ctx, size_t max_entries = SIZE_MAX);
+
+	// Writes 'format_trace' to the error sink of 'ctx', if errors are
+	// logged.  Same restriction as 'format_trace'.
+	void dump_trace(const context& ctx, size_t max_entries = SIZE_MAX);
+}
+
+#endif
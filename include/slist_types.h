@@ -1,10 +1,12 @@
 #ifndef SLIST_TYPES_H
 #define SLIST_TYPES_H
 
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
 
 #include <vector>
 
@@ -21,6 +23,15 @@ namespace slist
 	struct environment;
 	typedef std::shared_ptr<environment> environment_ptr;
 
+	struct promise;
+	typedef std::shared_ptr<promise> promise_ptr;
+
+	struct memo_cache;
+	typedef std::shared_ptr<memo_cache> memo_cache_ptr;
+
+	struct image;
+	typedef std::shared_ptr<image> image_ptr;
+
 	enum class node_type
 	{
 		empty,
@@ -30,14 +41,43 @@ namespace slist
 		number,
 		name,
 		string,
+		promise,
+	};
+
+	// Special forms are evaluated by the evaluator itself rather than by a
+	// native callback, so that they never recurse on the C stack.
+	enum class opcode
+	{
+		none,
+		quote,
+		lambda,
+		define,
+		defmacro,
+		set,
+		let,
+		letrec,
+		begin,
+		branch,
+		eval,
+		apply,
+		delay,
+		force,
+		stream_cons,
+		stream_cdr,
 	};
 
+	// Special form named 'name' by default, opcode::none for other names
+	opcode find_special_form(const std::string& name);
+
 	struct node : public std::enable_shared_from_this<node>
 	{
 		node();
+		~node();
 
 		size_t length() const;
 		node_ptr get(size_t index);
+
+		// Walks the whole list, use a 'list_builder' to append repeatedly
 		void append(const node_ptr& n);
 		node_ptr pop();
 
@@ -56,16 +96,42 @@ namespace slist
 		const std::string& to_string() const;
 		void set_string(const std::string& str);
 
-		void set_as_tail();
-
 		node_type type;
 		std::string value;
-		bool is_tail; // Used for tail-call elimination
+
+		// Names of special forms are tagged with their opcode when the node
+		// is created, so that the evaluator dispatches on it without looking
+		// the name up, unless the form is shadowed
+		opcode form;
+
+		// Cell of a quoted list pooled by the context, returned by each
+		// evaluation of the quote: destructive procedures refuse it
+		bool is_constant;
 
 		node_ptr car;
 		node_ptr cdr;
 
 		procedure_ptr proc;
+		promise_ptr promise;
+	};
+
+	// Appends to a list in constant time by keeping its last cell.  Like
+	// 'node::append', the first item goes in the car of an empty list.
+	struct list_builder
+	{
+		// Starts an empty list
+		list_builder();
+
+		// Continues the list 'head'
+		explicit list_builder(const node_ptr& head);
+
+		void append(const node_ptr& n);
+
+		node_ptr head;
+
+	private:
+		node *tail;
+		bool is_empty;
 	};
 
 	struct procedure : public std::enable_shared_from_this<procedure>
@@ -74,11 +140,17 @@ namespace slist
 
 		std::string name;
 
+		// Unique number of the procedure, identifying it in traces
+		uint32_t id;
+
 		node_ptr variables;
 
 		bool is_native;
 		bool is_macro;
-		bool is_tail;
+		bool is_strict; // Native: arguments are evaluated before calling native_func
+
+		// Special form (evaluated directly by the evaluator)
+		opcode form;
 
 		// Body of the function (non-native)
 		node_ptr body;
@@ -89,6 +161,26 @@ namespace slist
 
 		// Environment
 		environment_ptr env;
+
+		// Memoized procedure: calls are forwarded to 'memo->target'
+		memo_cache_ptr memo;
+	};
+
+	// A promise shared by several threads, through the parallel builtins
+	// or forks, may be forced by each of them at once: the expression is
+	// then evaluated more than once, and the first value stored wins.
+	struct promise
+	{
+		promise() : is_forced(false) {}
+
+		std::mutex lock; // Of the members below, not held while forcing
+
+		bool is_forced;
+		node_ptr value; // Memoized value, once forced
+
+		// Delayed expression, released once forced
+		node_ptr expr;
+		environment_ptr env;
 	};
 
 	struct environment : public std::enable_shared_from_this<environment>
@@ -99,11 +191,22 @@ namespace slist
 		node_ptr lookup_variable(const std::string& name);
 		bool set_variable(const std::string& name, node_ptr n);
 
+		// Decodes the bindings of the images of this environment and its
+		// parents that were not looked up yet.  Lookups may decode, so this
+		// must be done before sharing the environment between threads.
+		void load_image_bindings();
+
 		environment_ptr parent;
-		bool is_global;
+		bool is_global; // The global environment of a fork has the shared one as parent
 
 		typedef std::unordered_map<std::string, node_ptr> var_map;
 		var_map bindings;
+
+		// Loaded image, holding the bindings not looked up yet
+		image_ptr image;
+
+	private:
+		node_ptr *find_binding(const std::string& name);
 	};
 
 	std::string type_to_string(slist::node_type type);
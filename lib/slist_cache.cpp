@@ -0,0 +1,248 @@
+#include "slist_cache.h"
+#include "slist_file.h"
+#include "slist_log.h"
+#include "slist_parser.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+// Cache entry layout, little-endian:
+//
+//   "SLISTPRS" u32 version u32 source_size source
+//   nodes: u8 type u8 children string value, in preorder
+//
+// The whole source is stored: the file name is only a hash of it, and an
+// entry is used only when its source is the one being parsed.  'children'
+// tells whether the node has a car (1) and a cdr (2), which follow it.
+// Strings are a u32 length followed by the characters.
+
+namespace
+{
+    const char cache_magic[8] = { 'S', 'L', 'I', 'S', 'T', 'P', 'R', 'S' };
+
+    // Bumped whenever the parser or the layout changes, so that entries
+    // written by other versions are never read
+    const uint32_t cache_version = 3;
+
+    const uint8_t has_car = 1;
+    const uint8_t has_cdr = 2;
+
+    std::string entry_path(const char *source, size_t size, const std::string& cache_dir);
+    slist::node_ptr read_entry(const std::string& path, const char *source, size_t source_size);
+    void write_entry(const std::string& path, const char *source, size_t source_size, const slist::node_ptr& root);
+
+    void put(std::string& out, uint32_t value);
+    bool get(const char *&p, const char *end, uint32_t& value);
+}
+
+namespace slist
+{
+    node_ptr parse_cached(const std::string& source, const std::string& cache_dir)
+    {
+        return parse_cached(source.data(), source.size(), cache_dir);
+    }
+
+    node_ptr parse_cached(const char *source, size_t size, const std::string& cache_dir)
+    {
+        std::string path = entry_path(source, size, cache_dir);
+
+        node_ptr result = read_entry(path, source, size);
+        if (result != nullptr)
+        {
+            return result;
+        }
+
+        result = parse(source, size);
+        if (result != nullptr)
+        {
+            write_entry(path, source, size, result);
+        }
+        return result;
+    }
+}
+
+namespace
+{
+    std::string entry_path(const char *source, size_t size, const std::string& cache_dir)
+    {
+        // FNV-1a of the version and the source
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const char *p, size_t size)
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                hash ^= static_cast<unsigned char>(p[i]);
+                hash *= 1099511628211ull;
+            }
+        };
+        mix(reinterpret_cast<const char *>(&cache_version), sizeof(cache_version));
+        mix(source, size);
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.slc", static_cast<unsigned long long>(hash));
+
+        std::string path = cache_dir;
+        if (!path.empty() && path.back() != '/' && path.back() != '\\')
+        {
+            path += '/';
+        }
+        return path + name;
+    }
+
+    slist::node_ptr read_entry(const std::string& path, const char *source, size_t source_size)
+    {
+        using namespace slist;
+
+        mapped_file file;
+        if (!file.open(path, file_access::sequential))
+        {
+            return nullptr;
+        }
+
+        const char *p = file.data();
+        const char *end = p + file.size();
+
+        uint32_t version = 0;
+        uint32_t size = 0;
+        if (file.size() < sizeof(cache_magic) || memcmp(p, cache_magic, sizeof(cache_magic)) != 0)
+        {
+            return nullptr;
+        }
+        p += sizeof(cache_magic);
+
+        if (!get(p, end, version) || version != cache_version ||
+            !get(p, end, size) || size != source_size)
+        {
+            return nullptr;
+        }
+
+        // Another source with the same hash
+        if (static_cast<size_t>(end - p) < source_size || memcmp(p, source, source_size) != 0)
+        {
+            return nullptr;
+        }
+        p += source_size;
+
+        // Fields waiting for their node, the top one comes next
+        node_ptr root;
+        std::vector<node_ptr *> slots(1, &root);
+
+        while (!slots.empty())
+        {
+            node_ptr *slot = slots.back();
+            slots.pop_back();
+
+            uint32_t size = 0;
+            if (end - p < 2)
+            {
+                return nullptr;
+            }
+            uint8_t type = static_cast<uint8_t>(*p++);
+            uint8_t children = static_cast<uint8_t>(*p++);
+            if (type > static_cast<uint8_t>(node_type::string) ||
+                !get(p, end, size) || static_cast<size_t>(end - p) < size)
+            {
+                return nullptr;
+            }
+
+            node_ptr n(std::make_shared<node>());
+            n->type = static_cast<node_type>(type);
+            n->value.assign(p, size);
+            p += size;
+            if (n->type == node_type::name)
+            {
+                n->form = find_special_form(n->value);
+            }
+            *slot = n;
+
+            if (children & has_cdr)
+            {
+                slots.push_back(&n->cdr);
+            }
+            if (children & has_car)
+            {
+                slots.push_back(&n->car);
+            }
+        }
+
+        return (p == end) ? root : nullptr;
+    }
+
+    void write_entry(const std::string& path, const char *source, size_t source_size, const slist::node_ptr& root)
+    {
+        using namespace slist;
+
+        std::string data(cache_magic, sizeof(cache_magic));
+        put(data, cache_version);
+        put(data, static_cast<uint32_t>(source_size));
+        data.append(source, source_size);
+
+        std::vector<const node *> stack(1, root.get());
+        while (!stack.empty())
+        {
+            const node *n = stack.back();
+            stack.pop_back();
+
+            uint8_t children = (n->car != nullptr ? has_car : 0) | (n->cdr != nullptr ? has_cdr : 0);
+            data.push_back(static_cast<char>(n->type));
+            data.push_back(static_cast<char>(children));
+            put(data, static_cast<uint32_t>(n->value.size()));
+            data.append(n->value);
+
+            if (n->cdr != nullptr)
+            {
+                stack.push_back(n->cdr.get());
+            }
+            if (n->car != nullptr)
+            {
+                stack.push_back(n->car.get());
+            }
+        }
+
+        // Written next to the entry, then renamed over it, so that readers
+        // never see a partial entry
+        std::random_device random;
+        std::string tmp_path = path + "." + std::to_string(random()) + ".tmp";
+
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            // Read-only or missing cache directory
+            return;
+        }
+
+        out << data;
+        out.close();
+
+        if (!out || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tmp_path.c_str());
+        }
+    }
+
+    void put(std::string& out, uint32_t value)
+    {
+        out.push_back(static_cast<char>(value & 0xff));
+        out.push_back(static_cast<char>((value >> 8) & 0xff));
+        out.push_back(static_cast<char>((value >> 16) & 0xff));
+        out.push_back(static_cast<char>((value >> 24) & 0xff));
+    }
+
+    bool get(const char *&p, const char *end, uint32_t& value)
+    {
+        if (end - p < 4)
+        {
+            return false;
+        }
+        const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+        value = static_cast<uint32_t>(u[0]) |
+                static_cast<uint32_t>(u[1]) << 8 |
+                static_cast<uint32_t>(u[2]) << 16 |
+                static_cast<uint32_t>(u[3]) << 24;
+        p += 4;
+        return true;
+    }
+}
@@ -7,68 +7,160 @@
 namespace slist
 {
     context::context()
+        : shadowed_forms(std::make_shared<std::atomic<uint32_t>>(0))
+        , stack_size_limit(64 * 1024 * 1024)
+        , nesting_level(0)
+        , nesting_limit(1000)
+        , fuel_limit(0)
+        , time_limit(0)
+        , fuel_left(0)
+        , check_countdown(0)
+        , interrupt_requested(new std::atomic<bool>(false))
+        , parent(nullptr)
+        , parallel_chunk_size(0)
+        , trace(std::make_shared<trace_buffer>())
     {
+        log.level = get_log_level();
+
         // Prepare global environment
         global_env = std::make_shared<environment>();
         global_env->is_global = true;
 
         active_env = global_env;
 
-        register_native("eval",    &native_eval);
-        register_native("apply",   &native_apply);
-        register_native("cons",    &native_cons);
-        register_native("list",    &native_list);
-        register_native("car",     &native_car);
-        register_native("cdr",     &native_cdr);
-        register_native("quote",   &native_quote);
-        register_native("unquote", &native_unquote);
-        register_native("'",       &native_quote);      
-        register_native("lambda",  &native_lambda);
-        register_native("define",  &native_define);
-        register_native("defmacro",&native_defmacro);
-        register_native("set!",    &native_set);
-        register_native("let",     &native_let);
-        register_native("letrec",  &native_letrec);
-        register_native("begin",   &native_begin);
-        register_native("if",      &native_if);
-        register_native("length",  &native_length);
-        register_native("empty?",  &native_empty);
-        register_native("print",   &native_print);
-        register_native("println", &native_println);
-        register_native("eq?",     &native_eq);
-        register_native("equal?",  &native_equal);
-        register_native("not",     &native_not);
-
-        register_native("pair?",   &native_is_pair);
-        register_native("boolean?",&native_is_bool);
-        register_native("integer?",&native_is_int);
-        register_native("number?", &native_is_number);
-        register_native("string?", &native_is_string);
-        register_native("symbol?", &native_is_symbol);
-
-        register_native("+",       &native_add);
-        register_native("-",       &native_sub);
-        register_native("*",       &native_mul);
-        register_native("/",       &native_div);
-        register_native("%",       &native_mod);
-
-        register_native("=",       &native_e);
-        register_native("!=",      &native_ne);
-        register_native("<",       &native_lt);
-        register_native(">",       &native_gt);
-        register_native("<=",      &native_le);
-        register_native(">=",      &native_ge);
-
-        register_native("assert", &native_assert);
+        register_special_form("eval",    opcode::eval);
+        register_special_form("apply",   opcode::apply);
+        register_function("cons",        &native_cons);
+        register_function("list",        &native_list);
+        register_function("car",         &native_car);
+        register_function("cdr",         &native_cdr);
+        register_special_form("quote",   opcode::quote);
+        register_native("unquote",       &native_unquote);
+        register_special_form("'",       opcode::quote);
+        register_special_form("lambda",  opcode::lambda);
+        register_special_form("define",  opcode::define);
+        register_special_form("defmacro",opcode::defmacro);
+        register_special_form("set!",    opcode::set);
+        register_special_form("let",     opcode::let);
+        register_special_form("letrec",  opcode::letrec);
+        register_special_form("begin",   opcode::begin);
+        register_special_form("if",      opcode::branch);
+        register_function("length",      &native_length);
+        register_function("empty?",      &native_empty);
+        register_function("reverse!",    &native_reverse_inplace);
+        register_function("append!",     &native_append_inplace);
+        register_function("list-copy",   &native_list_copy);
+        register_function("print",       &native_print);
+        register_function("println",     &native_println);
+        register_function("flush",       &native_flush);
+        register_function("to-string",   &native_to_string);
+        register_function("write-string", &native_write_string);
+        register_function("eq?",         &native_eq);
+        register_function("equal?",      &native_equal);
+        register_function("not",         &native_not);
+
+        register_function("pair?",       &native_is_pair);
+        register_function("boolean?",    &native_is_bool);
+        register_function("integer?",    &native_is_int);
+        register_function("number?",     &native_is_number);
+        register_function("string?",     &native_is_string);
+        register_function("symbol?",     &native_is_symbol);
+
+        register_function("+",           &native_add);
+        register_function("-",           &native_sub);
+        register_function("*",           &native_mul);
+        register_function("/",           &native_div);
+        register_function("%",           &native_mod);
+
+        register_function("=",           &native_e);
+        register_function("!=",          &native_ne);
+        register_function("<",           &native_lt);
+        register_function(">",           &native_gt);
+        register_function("<=",          &native_le);
+        register_function(">=",          &native_ge);
+
+        register_function("assert",      &native_assert);
+
+        register_special_form("delay",   opcode::delay);
+        register_special_form("force",   opcode::force);
+        register_function("make-promise",&native_make_promise);
+        register_function("promise?",    &native_is_promise);
+
+        register_special_form("stream-cons", opcode::stream_cons);
+        register_special_form("stream-cdr",  opcode::stream_cdr);
+        register_function("stream-car",      &native_stream_car);
+        register_function("stream-map",      &native_stream_map);
+        register_function("stream-filter",   &native_stream_filter);
+        register_function("stream-take",     &native_stream_take);
+
+        register_function("memoize",         &native_memoize);
+        register_function("memoize-stats",   &native_memoize_stats);
+
+        register_function("pmap",            &native_pmap);
+        register_function("pfor-each",       &native_pfor_each);
+        register_function("preduce",         &native_preduce);
+
+        register_function("serialize",       &native_serialize);
+        register_function("deserialize",     &native_deserialize);
 
         // Execute the builtins script to register the builtin procedures
         //exec(*this, builtins);
     }
 
+    context::context(const environment_ptr& global_env)
+        : global_env(global_env)
+        , active_env(global_env)
+        , shadowed_forms(std::make_shared<std::atomic<uint32_t>>(0))
+        , stack_size_limit(64 * 1024 * 1024)
+        , nesting_level(0)
+        , nesting_limit(1000)
+        , fuel_limit(0)
+        , time_limit(0)
+        , fuel_left(0)
+        , check_countdown(0)
+        , interrupt_requested(new std::atomic<bool>(false))
+        , parent(nullptr)
+        , parallel_chunk_size(0)
+    {
+        log.level = get_log_level();
+    }
+
+    context context::fork() const
+    {
+        // Forks share the global environment read-only
+        global_env->load_image_bindings();
+
+        environment_ptr overlay(std::make_shared<environment>());
+        overlay->is_global = true;
+        overlay->parent = global_env;
+
+        context result(overlay);
+        result.symbols = symbols; // Quoted data of the parent keeps its identity
+        result.shadowed_forms = shadowed_forms;
+        result.stack_size_limit = stack_size_limit;
+        result.nesting_limit = nesting_limit;
+        result.log = log;
+        result.pool = pool;
+        result.parallel_chunk_size = parallel_chunk_size;
+        result.fuel_limit = fuel_limit;
+        result.time_limit = time_limit;
+        if (trace != nullptr)
+        {
+            result.trace = std::make_shared<trace_buffer>(trace->capacity());
+        }
+
+        return result;
+    }
+
+    void context::interrupt()
+    {
+        *interrupt_requested = true;
+    }
+
     void context::register_native(const std::string& name, procedure::callback func)
     {
         procedure_ptr f(std::make_shared<procedure>());
-        f->env->parent = active_env;
+        f->name = name;
         f->is_native = true;
         f->native_func = func;
 
@@ -76,6 +168,42 @@ namespace slist
         n->proc = f;
 
         global_env->register_variable(name, n);
+
+        opcode shadowed = find_special_form(name);
+        if (shadowed != opcode::none)
+        {
+            shadow_special_form(shadowed);
+        }
+    }
+
+    void context::register_function(const std::string& name, procedure::callback func)
+    {
+        register_native(name, func);
+        global_env->lookup_variable(name)->proc->is_strict = true;
+    }
+
+    void context::register_special_form(const std::string& name, opcode form)
+    {
+        procedure_ptr f(std::make_shared<procedure>());
+        f->name = name;
+        f->is_native = true;
+        f->form = form;
+
+        node_ptr n(std::make_shared<node>());
+        n->proc = f;
+
+        global_env->register_variable(name, n);
+
+        opcode shadowed = find_special_form(name);
+        if (shadowed != opcode::none && shadowed != form)
+        {
+            shadow_special_form(shadowed);
+        }
+    }
+
+    void context::shadow_special_form(opcode form)
+    {
+        *shadowed_forms |= 1u << static_cast<uint32_t>(form);
     }
 
     node_ptr context::lookup_symbol(const std::string& name)
@@ -85,6 +213,22 @@ namespace slist
         {
             return it->second;
         }
+
+        if (parent != nullptr && worker_symbols != nullptr)
+        {
+            auto parent_it = parent->symbols.find(name);
+            if (parent_it != parent->symbols.end())
+            {
+                return parent_it->second;
+            }
+
+            std::lock_guard<std::mutex> guard(worker_symbols->lock);
+            it = worker_symbols->symbols.find(name);
+            if (it != worker_symbols->symbols.end())
+            {
+                return it->second;
+            }
+        }
         return nullptr;
     }
 
@@ -96,17 +240,47 @@ namespace slist
             return;
         }
 
+        if (parent != nullptr && worker_symbols != nullptr)
+        {
+            std::lock_guard<std::mutex> guard(worker_symbols->lock);
+            worker_symbols->symbols[node->value] = node;
+            return;
+        }
+
         symbols[node->value] = node;
     }
 
+    node_ptr context::intern_symbol(const node_ptr& node)
+    {
+        if (node == nullptr || node->type != node_type::name)
+        {
+            log_errorln("Trying to intern an invalid symbol: ", node);
+            return node;
+        }
+
+        if (parent != nullptr && worker_symbols != nullptr)
+        {
+            auto it = parent->symbols.find(node->value);
+            if (it != parent->symbols.end())
+            {
+                return it->second;
+            }
+
+            // Inserted only if no other worker interned it first
+            std::lock_guard<std::mutex> guard(worker_symbols->lock);
+            return worker_symbols->symbols.emplace(node->value, node).first->second;
+        }
+
+        return symbols.emplace(node->value, node).first->second;
+    }
+
     void context::debug_dump_callstack()
     {
         using namespace slist;
         int index = 0;
-        for (auto& item : callstack)
+        for (auto& item : frames)
         {
-            (void)item;
-            LOG_TRACELN2("[" + std::to_string(index) + "]: ", item.node);
+            log_traceln_slow("[", index, "]: ", item.root);
             ++index;
         }
     }
@@ -1,363 +1,1815 @@
 #include "slist_eval.h"
 #include "slist_parser.h"
+#include "slist_cache.h"
 #include "slist_log.h"
+#include "slist_memo.h"
+#include "slist_observer.h"
 
+#include <algorithm>
+#include <exception>
 #include <istream>
+#include <iterator>
+#include <limits>
+
+// Observer hooks cost a branch when no observer is attached, and nothing
+// when compiled out
+#ifdef SLIST_NO_OBSERVERS
+#define OBSERVE(CTX, HOOK) do {} while (0)
+#else
+#define OBSERVE(CTX, HOOK) do { if ((CTX).observer != nullptr) { (CTX).observer->HOOK; } } while (0)
+#endif
+
+// The evaluator is a CEK-style machine: the expression being evaluated
+// and its environment live in 'registers', and every pending computation
+// is a 'context::frame' on the heap-allocated 'ctx.frames' stack.  Calls in
+// tail position do not push any frame, and non-tail recursion only grows
+// 'ctx.frames', bounded by 'ctx.stack_size_limit'.
+
+namespace slist
+{
+    // Constants of the quoted lists of a context, by datum.  Entries hold
+    // the datum weakly, so that code can be freed; the ones of freed code
+    // are purged when the pool has doubled.
+    struct constant_pool
+    {
+        constant_pool() : purge_size(256) {}
+
+        struct entry
+        {
+            std::weak_ptr<node> datum;
+            node_ptr value; // nullptr for templates
+        };
+
+        std::unordered_map<const node *, entry> entries;
+        size_t purge_size;
+    };
+}
 
 namespace
 {
-    slist::node_ptr eval_list(slist::context& ctx, const slist::node_ptr& root);
-    slist::node_ptr eval_name(slist::context& ctx, const slist::node_ptr& root);
+    // Calls and returns shown when an evaluation fails
+    const size_t dumped_trace_size = 32;
+
+    struct registers
+    {
+        registers(size_t base, size_t call_base) : has_value(false), base(base), call_base(call_base) {}
+
+        slist::node_ptr expr;       // Expression to evaluate next
+        slist::environment_ptr env; // Environment of the expression
+        slist::node_ptr value;      // Value returned to the top frame
+        bool has_value;
+        size_t base;                // First frame of this run
+        size_t call_base;           // First pending call of this run
+    };
+
+    typedef slist::context::frame frame;
+
+    // Frames below 'base' belong to an enclosing 'run' (natives calling
+    // 'eval').  On errors, drop our frames so the context stays usable.
+    // The guard must be created before any frame is pushed.
+    struct run_guard
+    {
+        run_guard(slist::context& ctx);
+        ~run_guard();
+
+        slist::context& ctx;
+        size_t base;
+        size_t call_base;
+        slist::environment_ptr env;
+        slist::log_scope scope;
+    };
+
+    slist::node_ptr run(slist::context& ctx, registers& regs, const run_guard& guard);
+    bool run_slice(slist::context& ctx, registers& regs, const run_guard& guard, slist::evaluation& e,
+                   size_t max_steps, std::chrono::steady_clock::duration max_time);
+
+    void start_limits(slist::context& ctx);
+    void count_call(slist::context& ctx);
+    void check_limits(slist::context& ctx);
+
+    void eval_step(slist::context& ctx, registers& regs);
+    void eval_pair(slist::context& ctx, registers& regs);
+    void dispatch(slist::context& ctx, registers& regs, const slist::node_ptr& root, const slist::node_ptr& proc_node);
+    void invoke(slist::context& ctx, registers& regs, const slist::node_ptr& root, const slist::node_ptr& proc_node, slist::node_ptr args);
+    void call_native(slist::context& ctx, registers& regs, const slist::procedure_ptr& proc, const slist::node_ptr& root);
+    void resume(slist::context& ctx, registers& regs);
+
+    void eval_special_form(slist::context& ctx, registers& regs, const slist::node_ptr& root, slist::opcode form);
+    void eval_quote(slist::context& ctx, registers& regs, const slist::node_ptr& root);
+    void eval_lambda(slist::context& ctx, registers& regs, const slist::node_ptr& root);
+    void eval_define(slist::context& ctx, registers& regs, const slist::node_ptr& root, bool is_macro);
+    void eval_set(slist::context& ctx, registers& regs, const slist::node_ptr& root);
+    void eval_let(slist::context& ctx, registers& regs, const slist::node_ptr& root, bool is_rec);
+    void eval_begin(slist::context& ctx, registers& regs, const slist::node_ptr& root);
+    void eval_if(slist::context& ctx, registers& regs, const slist::node_ptr& root);
+    void eval_delay(slist::context& ctx, registers& regs, const slist::node_ptr& root);
+    void eval_stream_cons(slist::context& ctx, registers& regs, const slist::node_ptr& root);
+    void force_promise(slist::context& ctx, registers& regs, const slist::node_ptr& n);
+
+    void advance_bindings(slist::context& ctx, registers& regs);
+    void advance_quote(slist::context& ctx, registers& regs);
+
+    slist::node_ptr lookup_variable(slist::context& ctx, const slist::environment_ptr& env, const std::string& name);
+    bool set_variable(slist::context& ctx, const slist::environment_ptr& env, const std::string& name, const slist::node_ptr& value);
+
+    bool evaluates_arguments(slist::opcode form);
+    void observe_call(slist::context& ctx, registers& regs, const slist::node_ptr& proc_node, const slist::node_ptr& args);
+    void observe_returns(slist::context& ctx, registers& regs);
+    const slist::node_ptr& special_form_node(slist::opcode form);
+    bool is_shadowed(slist::context& ctx, slist::opcode form);
+    void check_shadowing(slist::context& ctx, const slist::node_ptr& name);
+    void check_shadowing_variables(slist::context& ctx, const slist::node_ptr& variables);
+    bool bind_arguments(slist::context& ctx, const slist::procedure_ptr& proc, slist::node_ptr args, slist::environment_ptr& env);
+    slist::environment_ptr make_environment(slist::context& ctx, const slist::environment_ptr& parent);
+    void release_environment(slist::context& ctx, slist::environment_ptr& env);
+    slist::node_ptr make_promise(const slist::node_ptr& expr, const slist::environment_ptr& env);
+    bool is_unquote(const slist::node_ptr& n);
+    slist::node_ptr quote_atom(slist::context& ctx, const slist::node_ptr& n);
+    bool find_constant(slist::context& ctx, const slist::node_ptr& datum, slist::node_ptr& value);
+    slist::node_ptr make_constant(slist::context& ctx, const slist::node_ptr& datum);
+
+    // Globals are resolved in the global environment of the context rather
+    // than the one captured by the procedure, so that procedures inherited
+    // by a fork see the definitions of the fork
+    slist::node_ptr lookup_variable(slist::context& ctx, const slist::environment_ptr& env, const std::string& name)
+    {
+        using namespace slist;
+
+        for (environment *e = env.get(); e != nullptr && !e->is_global; e = e->parent.get())
+        {
+            auto it = e->bindings.find(name);
+            if (it != e->bindings.end())
+            {
+                return it->second;
+            }
+        }
+
+        return ctx.global_env->lookup_variable(name);
+    }
+
+    bool set_variable(slist::context& ctx, const slist::environment_ptr& env, const std::string& name, const slist::node_ptr& value)
+    {
+        using namespace slist;
+
+        for (environment *e = env.get(); e != nullptr && !e->is_global; e = e->parent.get())
+        {
+            auto it = e->bindings.find(name);
+            if (it != e->bindings.end())
+            {
+                it->second = value;
+                return true;
+            }
+        }
+
+        return ctx.global_env->set_variable(name, value);
+    }
+
+    frame& push_frame(slist::context& ctx, frame::kind type, const slist::node_ptr& root, const slist::environment_ptr& env);
+    void append(frame& f, const slist::node_ptr& value);
+
+    void set_expr(registers& regs, const slist::node_ptr& expr, const slist::environment_ptr& env);
+    void set_value(registers& regs, const slist::node_ptr& value);
+
+    slist::node_ptr eval_forms(slist::context& ctx, slist::form_reader& reader, std::streambuf *input = nullptr);
 }
 
 namespace slist
 {
     node_ptr eval(context& ctx, const node_ptr& root)
     {
-        ctx.debug_dump_callstack();
-        LOG_TRACELN2("Eval: ", root);
+        run_guard guard(ctx);
+        registers regs(guard.base, guard.call_base);
+        set_expr(regs, root, ctx.active_env);
+        return run(ctx, regs, guard);
+    }
+
+    node_ptr eval_procedure(context& ctx, const node_ptr& proc_node, const node_ptr& args)
+    {
+        if (proc_node == nullptr || proc_node->proc == nullptr)
+        {
+            return nullptr;
+        }
+
+        run_guard guard(ctx);
+        registers regs(guard.base, guard.call_base);
+        regs.env = ctx.active_env;
+        invoke(ctx, regs, nullptr, proc_node, args);
+        return run(ctx, regs, guard);
+    }
+
+    node_ptr apply(context& ctx, const node_ptr& args, const node_ptr& proc_node)
+    {
+        node_ptr root(std::make_shared<node>());
+        root->type = node_type::pair;
+        root->car = proc_node;
+        root->cdr = args;
+
+        return eval(ctx, root);
+    }
+
+    node_ptr force(context& ctx, const node_ptr& n)
+    {
+        if (n == nullptr || n->type != node_type::promise)
+        {
+            return n;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(n->promise->lock);
+            if (n->promise->is_forced)
+            {
+                return n->promise->value;
+            }
+        }
+
+        run_guard guard(ctx);
+        registers regs(guard.base, guard.call_base);
+        regs.env = ctx.active_env;
+        force_promise(ctx, regs, n);
+        return run(ctx, regs, guard);
+    }
+
+    evaluation::evaluation()
+        : is_done(false)
+        , has_value(true)
+    {
+    }
+
+    evaluation_ptr run_for(context& ctx, const node_ptr& program, size_t max_steps,
+                           std::chrono::steady_clock::duration max_time)
+    {
+        evaluation_ptr e(std::make_shared<evaluation>());
+        e->forms = program;
+        e->env = ctx.active_env;
+
+        run_for(ctx, e, max_steps, max_time);
+        return e;
+    }
+
+    bool run_for(context& ctx, const evaluation_ptr& e, size_t max_steps,
+                 std::chrono::steady_clock::duration max_time)
+    {
+        if (e == nullptr || e->is_done)
+        {
+            return true;
+        }
+
+        run_guard guard(ctx);
+
+        // Move the suspended state back into the evaluator
+        registers regs(guard.base, guard.call_base);
+        regs.expr = std::move(e->expr);
+        regs.env = std::move(e->env);
+        regs.value = std::move(e->value);
+        regs.has_value = e->has_value;
+        std::move(e->frames.begin(), e->frames.end(), std::back_inserter(ctx.frames));
+        e->frames.clear();
+        for (auto& call : e->pending_calls)
+        {
+            call.depth += guard.base;
+            ctx.pending_calls.push_back(std::move(call));
+        }
+        e->pending_calls.clear();
+
+        bool is_done = false;
+        try
+        {
+            is_done = run_slice(ctx, regs, guard, *e, max_steps, max_time);
+        }
+        catch (...)
+        {
+            e->is_done = true;
+            e->forms = nullptr;
+            throw;
+        }
+
+        if (!is_done)
+        {
+            e->expr = std::move(regs.expr);
+            e->env = std::move(regs.env);
+            e->value = std::move(regs.value);
+            e->has_value = regs.has_value;
+            std::move(ctx.frames.begin() + guard.base, ctx.frames.end(), std::back_inserter(e->frames));
+            ctx.frames.erase(ctx.frames.begin() + guard.base, ctx.frames.end());
+            for (size_t i = guard.call_base; i < ctx.pending_calls.size(); ++i)
+            {
+                ctx.pending_calls[i].depth -= guard.base;
+                e->pending_calls.push_back(std::move(ctx.pending_calls[i]));
+            }
+            ctx.pending_calls.erase(ctx.pending_calls.begin() + guard.call_base, ctx.pending_calls.end());
+        }
+        return is_done;
+    }
+
+    node_ptr exec(context& ctx, const std::string& str)
+    {
+        form_reader reader(str.data(), str.size());
+        node_ptr result = eval_forms(ctx, reader);
+        ctx.log.out->flush();
+        return result;
+    }
+
+    node_ptr exec(context& ctx, const char *data, size_t size)
+    {
+        if (ctx.parse_cache_dir.empty())
+        {
+            form_reader reader(data, size);
+            node_ptr result = eval_forms(ctx, reader);
+            ctx.log.out->flush();
+            return result;
+        }
+
+        // The cache is keyed by the whole source
+        run_guard guard(ctx);
+
+        node_ptr result;
+        for (node_ptr n = parse_cached(data, size, ctx.parse_cache_dir); n != nullptr; n = n->cdr)
+        {
+            result = eval(ctx, n->car);
+        }
+        ctx.log.out->flush();
+        return result;
+    }
+
+    node_ptr exec(context& ctx, std::istream& in)
+    {
+        if (ctx.parse_cache_dir.empty())
+        {
+            form_reader reader(in);
+            node_ptr result = eval_forms(ctx, reader, in.rdbuf());
+            ctx.log.out->flush();
+            return result;
+        }
+
+        std::string s((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        return exec(ctx, s.data(), s.size());
+    }
+}
+
+namespace
+{
+    run_guard::run_guard(slist::context& ctx)
+        : ctx(ctx)
+        , base(ctx.frames.size())
+        , call_base(ctx.pending_calls.size())
+        , env(ctx.active_env)
+        , scope(ctx.log)
+    {
+        if (ctx.nesting_level >= ctx.nesting_limit)
+        {
+            throw slist::stack_overflow_error("Stack overflow: too many nested evaluations");
+        }
+
+        if (ctx.nesting_level == 0 && ctx.parent == nullptr)
+        {
+            start_limits(ctx);
+        }
+        ++ctx.nesting_level;
+    }
+
+    run_guard::~run_guard()
+    {
+        --ctx.nesting_level;
+
+        // The evaluation started by the host fails
+        if (ctx.nesting_level == 0 && ctx.trace != nullptr && std::uncaught_exception())
+        {
+            slist::dump_trace(ctx, dumped_trace_size);
+        }
+
+        if (ctx.frames.size() > base)
+        {
+            ctx.frames.erase(ctx.frames.begin() + base, ctx.frames.end());
+            ctx.active_env = env;
+        }
+        if (ctx.pending_calls.size() > call_base)
+        {
+            ctx.pending_calls.erase(ctx.pending_calls.begin() + call_base, ctx.pending_calls.end());
+        }
+    }
+
+    slist::node_ptr run(slist::context& ctx, registers& regs, const run_guard& guard)
+    {
+        using namespace slist;
+
+        while (true)
+        {
+            if (!regs.has_value)
+            {
+                eval_step(ctx, regs);
+                continue;
+            }
+
+#ifndef SLIST_NO_OBSERVERS
+            if (ctx.pending_calls.size() > regs.call_base && ctx.pending_calls.back().depth >= ctx.frames.size())
+            {
+                observe_returns(ctx, regs);
+            }
+#endif
+            if (ctx.frames.size() == guard.base)
+            {
+                return regs.value;
+            }
+            resume(ctx, regs);
+        }
+    }
+
+    // Same as 'run', but returns false once the budget is spent.  Runs the
+    // top-level forms of 'e' one after the other.
+    bool run_slice(slist::context& ctx, registers& regs, const run_guard& guard, slist::evaluation& e,
+                   size_t max_steps, std::chrono::steady_clock::duration max_time)
+    {
+        using namespace slist;
+
+        const size_t steps_per_clock_check = 64;
+        auto deadline = std::chrono::steady_clock::now() + max_time;
+
+        for (size_t step = 1; ; ++step)
+        {
+            if (!regs.has_value)
+            {
+                eval_step(ctx, regs);
+            }
+#ifndef SLIST_NO_OBSERVERS
+            else if (ctx.pending_calls.size() > regs.call_base && ctx.pending_calls.back().depth >= ctx.frames.size())
+            {
+                observe_returns(ctx, regs);
+            }
+#endif
+            else if (ctx.frames.size() == guard.base)
+            {
+                e.result = regs.value;
+                if (e.forms == nullptr)
+                {
+                    e.is_done = true;
+                    return true;
+                }
+
+                set_expr(regs, e.forms->car, guard.env);
+                e.forms = e.forms->cdr;
+            }
+            else
+            {
+                resume(ctx, regs);
+            }
+
+            if (max_steps > 0 && step >= max_steps)
+            {
+                return false;
+            }
+
+            if (max_time.count() > 0 && step % steps_per_clock_check == 0 &&
+                std::chrono::steady_clock::now() >= deadline)
+            {
+                return false;
+            }
+        }
+    }
+
+    // Calls between two checks of the interruption and of the deadline
+    const size_t check_interval = 256;
+
+    void start_limits(slist::context& ctx)
+    {
+        using namespace slist;
+
+        *ctx.interrupt_requested = false;
+        ctx.fuel_left = (ctx.fuel_limit > 0) ? ctx.fuel_limit : std::numeric_limits<size_t>::max();
+        ctx.deadline = (ctx.time_limit.count() > 0) ? std::chrono::steady_clock::now() + ctx.time_limit
+                                                    : std::chrono::steady_clock::time_point::max();
+        ctx.check_countdown = 0;
+    }
+
+    void count_call(slist::context& ctx)
+    {
+        if (ctx.check_countdown == 0)
+        {
+            check_limits(ctx);
+        }
+        --ctx.check_countdown;
+    }
+
+    void check_limits(slist::context& ctx)
+    {
+        using namespace slist;
+        typedef evaluation_interrupted::reason reason;
+
+        const context& owner = (ctx.parent != nullptr) ? *ctx.parent : ctx;
+        if (*owner.interrupt_requested)
+        {
+            throw evaluation_interrupted(reason::interrupt, "Evaluation interrupted");
+        }
+
+        if (owner.deadline != std::chrono::steady_clock::time_point::max() &&
+            std::chrono::steady_clock::now() >= owner.deadline)
+        {
+            throw evaluation_interrupted(reason::deadline, "Evaluation exceeded its time limit");
+        }
+
+        // Worker contexts are not limited by calls
+        if (ctx.parent != nullptr)
+        {
+            ctx.check_countdown = check_interval;
+            return;
+        }
+
+        if (ctx.fuel_left == 0)
+        {
+            throw evaluation_interrupted(reason::fuel, "Evaluation ran out of fuel");
+        }
+
+        ctx.check_countdown = std::min(ctx.fuel_left, check_interval);
+        ctx.fuel_left -= ctx.check_countdown;
+    }
+
+    void eval_step(slist::context& ctx, registers& regs)
+    {
+        using namespace slist;
+
+        OBSERVE(ctx, on_enter(ctx, regs.expr, regs.env));
+
+        if (regs.expr == nullptr)
+        {
+            set_value(regs, nullptr);
+            return;
+        }
+
+        switch (regs.expr->type)
+        {
+            case node_type::pair:
+                eval_pair(ctx, regs);
+                break;
+            case node_type::name:
+                {
+                    auto var_node = lookup_variable(ctx, regs.env, regs.expr->value);
+                    if (var_node == nullptr)
+                    {
+                        log_errorln("Could not evaluate variable: ", regs.expr);
+                    }
+                    set_value(regs, var_node);
+                }
+                break;
+            case node_type::empty:
+            case node_type::boolean:
+            case node_type::integer:
+            case node_type::number:
+            case node_type::string:
+            case node_type::promise:
+                set_value(regs, regs.expr);
+                break;
+        }
+    }
+
+    void eval_pair(slist::context& ctx, registers& regs)
+    {
+        using namespace slist;
+
+        node_ptr root = regs.expr;
+        node_ptr op_node = root->car;
+
+        if (op_node == nullptr)
+        {
+            log_errorln("Cannot evaluate empty list.");
+            set_value(regs, nullptr);
+            return;
+        }
+
+        if (op_node->proc != nullptr)
+        {
+            dispatch(ctx, regs, root, op_node);
+            return;
+        }
+
+        if (op_node->form != opcode::none && !is_shadowed(ctx, op_node->form))
+        {
+            // Special forms are recognized by the parser, their names need
+            // no lookup as long as nothing binds them
+            dispatch(ctx, regs, root, special_form_node(op_node->form));
+            return;
+        }
+
+        if (op_node->type == node_type::name)
+        {
+            // Look in environment
+            node_ptr val = lookup_variable(ctx, regs.env, op_node->value);
+            if (val != nullptr && val->proc != nullptr)
+            {
+                dispatch(ctx, regs, root, val);
+                return;
+            }
+        }
+        else if (op_node->type == node_type::pair)
+        {
+            push_frame(ctx, frame::kind::call_operator, root, regs.env);
+            set_expr(regs, op_node, regs.env);
+            return;
+        }
+
+        log_errorln("Operator is not a procedure: ", op_node);
+        set_value(regs, nullptr);
+    }
+
+    void dispatch(slist::context& ctx, registers& regs, const slist::node_ptr& root, const slist::node_ptr& proc_node)
+    {
+        using namespace slist;
+
+        const procedure_ptr& proc = proc_node->proc;
+
+        if (!evaluates_arguments(proc->form))
+        {
+            eval_special_form(ctx, regs, root, proc->form);
+            return;
+        }
+
+        if (proc->is_macro)
+        {
+            count_call(ctx);
+
+            // Do not evaluate macro arguments
+            environment_ptr env;
+            if (!bind_arguments(ctx, proc, root->cdr, env))
+            {
+                set_value(regs, nullptr);
+                return;
+            }
+            push_frame(ctx, frame::kind::macro_expand, root, regs.env);
+            set_expr(regs, proc->body, env);
+            return;
+        }
+
+        if (proc->is_native && !proc->is_strict && proc->form == opcode::none)
+        {
+#ifndef SLIST_NO_OBSERVERS
+            if (ctx.observer != nullptr || ctx.trace != nullptr)
+            {
+                observe_call(ctx, regs, proc_node, root->cdr);
+            }
+#endif
+            call_native(ctx, regs, proc, root);
+            return;
+        }
+
+        if (root->cdr == nullptr)
+        {
+            invoke(ctx, regs, root, proc_node, nullptr);
+            return;
+        }
+
+        frame& f = push_frame(ctx, frame::kind::call_arguments, root, regs.env);
+        f.proc_node = proc_node;
+        f.pending = root->cdr;
+        set_expr(regs, root->cdr->car, regs.env);
+    }
+
+    void invoke(slist::context& ctx, registers& regs, const slist::node_ptr& root, const slist::node_ptr& proc_node, slist::node_ptr args)
+    {
+        using namespace slist;
+
+        const procedure_ptr& proc = proc_node->proc;
+
+        count_call(ctx);
+
+        switch (proc->form)
+        {
+            case opcode::none:
+                break;
+            case opcode::eval:
+                if (args == nullptr || args->cdr != nullptr)
+                {
+                    log_errorln("'eval' expects one argument: ", root);
+                    set_value(regs, nullptr);
+                    return;
+                }
+                set_expr(regs, args->car, regs.env);
+                return;
+            case opcode::apply:
+                {
+                    if (args == nullptr || args->cdr == nullptr)
+                    {
+                        log_errorln("Not enough arguments for 'apply'\n", root);
+                        set_value(regs, nullptr);
+                        return;
+                    }
+
+                    node_ptr func_node = args->car;
+                    if (func_node == nullptr || func_node->proc == nullptr)
+                    {
+                        log_errorln("First argument for 'apply' is not a procedure:\n", func_node);
+                        set_value(regs, nullptr);
+                        return;
+                    }
+
+                    node_ptr func_args = args->cdr->car;
+                    if (func_args != nullptr && func_args->type != node_type::pair)
+                    {
+                        log_errorln("Arguments is not a list:\n", func_args);
+                        set_value(regs, nullptr);
+                        return;
+                    }
+
+                    if (func_args != nullptr && func_args->car == nullptr)
+                    {
+                        // Empty list
+                        func_args = nullptr;
+                    }
+
+                    invoke(ctx, regs, nullptr, func_node, func_args);
+                }
+                return;
+            case opcode::force:
+                if (args == nullptr || args->cdr != nullptr)
+                {
+                    log_errorln("'force' expects one argument: ", root);
+                    set_value(regs, nullptr);
+                    return;
+                }
+                force_promise(ctx, regs, args->car);
+                return;
+            case opcode::stream_cdr:
+                if (args == nullptr || args->cdr != nullptr ||
+                    args->car == nullptr || args->car->type != node_type::pair)
+                {
+                    log_errorln("'stream-cdr' expects a stream: ", root);
+                    set_value(regs, nullptr);
+                    return;
+                }
+                force_promise(ctx, regs, args->car->cdr);
+                return;
+            default:
+                log_errorln("Cannot apply a special form: ", proc_node);
+                set_value(regs, nullptr);
+                return;
+        }
+
+#ifndef SLIST_NO_OBSERVERS
+        if ((ctx.observer != nullptr || ctx.trace != nullptr) && !proc->is_macro)
+        {
+            observe_call(ctx, regs, proc_node, args);
+        }
+#endif
+
+        if (proc->memo != nullptr)
+        {
+            node_ptr value;
+            if (proc->memo->lookup(args, value))
+            {
+                set_value(regs, value);
+                return;
+            }
+
+            frame& f = push_frame(ctx, frame::kind::memo_store, root, regs.env);
+            f.proc_node = proc_node;
+            f.pending = args;
+
+            node_ptr target = proc->memo->target;
+            invoke(ctx, regs, root, target, args);
+            return;
+        }
+
+        if (proc->is_native)
+        {
+            node_ptr call(std::make_shared<node>());
+            call->type = node_type::pair;
+            call->car = (root != nullptr) ? root->car : proc_node;
+            call->cdr = std::move(args);
+
+            call_native(ctx, regs, proc, call);
+            return;
+        }
+
+        if (proc->is_macro)
+        {
+            push_frame(ctx, frame::kind::macro_expand, root, regs.env);
+        }
+        else
+        {
+            // The caller is done with its environment when this is a
+            // tail call, the callee can reuse it
+            release_environment(ctx, regs.env);
+        }
+
+        environment_ptr env;
+        if (!bind_arguments(ctx, proc, args, env))
+        {
+            set_value(regs, nullptr);
+            return;
+        }
+
+        // No frame is pushed for the call itself: this is what makes
+        // calls in tail position run in constant space.
+        set_expr(regs, proc->body, env);
+    }
+
+    void call_native(slist::context& ctx, registers& regs, const slist::procedure_ptr& proc, const slist::node_ptr& root)
+    {
+        using namespace slist;
+
+        // Replaced by the result: the last argument must not stay alive
+        // through it, natives may drop their arguments
+        regs.value = nullptr;
+
+        auto prev_env = ctx.active_env;
+        ctx.active_env = regs.env;
+        auto result = proc->native_func(ctx, root);
+        ctx.active_env = prev_env;
+
+#ifndef SLIST_NO_OBSERVERS
+        // Returns of natives are only pending calls for observers
+        if (ctx.trace != nullptr && ctx.observer == nullptr)
+        {
+            ctx.trace->record(trace_event::exit, proc->id);
+        }
+#endif
+
+        set_value(regs, result);
+    }
+
+    void resume(slist::context& ctx, registers& regs)
+    {
+        using namespace slist;
+
+        // The value is computed, its environment is not needed anymore
+        release_environment(ctx, regs.env);
+
+        frame& f = ctx.frames.back();
+
+        switch (f.type)
+        {
+            case frame::kind::call_operator:
+                {
+                    node_ptr root = f.root;
+                    regs.env = f.env;
+                    ctx.frames.pop_back();
+
+                    node_ptr proc_node = regs.value;
+                    if (proc_node == nullptr || proc_node->proc == nullptr)
+                    {
+                        log_errorln("Error: first argument is not a procedure", root);
+                        set_value(regs, nullptr);
+                        return;
+                    }
+                    dispatch(ctx, regs, root, proc_node);
+                }
+                break;
+
+            case frame::kind::call_arguments:
+                append(f, regs.value);
+                f.pending = f.pending->cdr;
+                if (f.pending != nullptr)
+                {
+                    set_expr(regs, f.pending->car, f.env);
+                }
+                else
+                {
+                    node_ptr root = f.root;
+                    node_ptr proc_node = f.proc_node;
+                    node_ptr args = std::move(f.head);
+                    regs.env = f.env;
+                    ctx.frames.pop_back();
+
+                    // The arguments are then only held by the call
+                    invoke(ctx, regs, root, proc_node, std::move(args));
+                }
+                break;
+
+            case frame::kind::macro_expand:
+                {
+                    environment_ptr env = f.env;
+                    ctx.frames.pop_back();
+                    set_expr(regs, regs.value, env);
+                }
+                break;
+
+            case frame::kind::branch:
+                {
+                    node_ptr root = f.root;
+                    environment_ptr env = f.env;
+                    ctx.frames.pop_back();
+
+                    node_ptr pred = regs.value;
+                    if (pred == nullptr || pred->type != node_type::boolean)
+                    {
+                        log_errorln("Predicate did not evaluate to a boolean value");
+                        set_value(regs, nullptr);
+                        return;
+                    }
+
+                    set_expr(regs, root->get(pred->to_bool() ? 2 : 3), env);
+                }
+                break;
+
+            case frame::kind::sequence:
+                {
+                    node_ptr next = f.pending;
+                    if (next->cdr == nullptr)
+                    {
+                        // Last expression is in tail position
+                        environment_ptr env = f.env;
+                        ctx.frames.pop_back();
+                        set_expr(regs, next->car, env);
+                    }
+                    else
+                    {
+                        f.pending = next->cdr;
+                        set_expr(regs, next->car, f.env);
+                    }
+                }
+                break;
+
+            case frame::kind::bind:
+                if (f.env->is_global)
+                {
+                    ctx.global_env->register_variable(f.pending->value, regs.value);
+                }
+                else
+                {
+                    f.env->register_variable(f.pending->value, regs.value);
+                }
+                ctx.frames.pop_back();
+                set_value(regs, nullptr);
+                break;
+
+            case frame::kind::assign:
+                if (!set_variable(ctx, f.env, f.pending->value, regs.value))
+                {
+                    log_errorln("Cannot set unbound variable: ", f.pending);
+                }
+                ctx.frames.pop_back();
+                set_value(regs, nullptr);
+                break;
+
+            case frame::kind::bindings:
+                f.target->register_variable(f.pending->car->car->value, regs.value);
+                f.pending = f.pending->cdr;
+                advance_bindings(ctx, regs);
+                break;
+
+            case frame::kind::quote_list:
+                if (regs.value != nullptr)
+                {
+                    append(f, regs.value);
+                }
+                else
+                {
+                    log_errorln("Cannot quote: ", f.root);
+                }
+                advance_quote(ctx, regs);
+                break;
+
+            case frame::kind::force_promise:
+                {
+                    promise_ptr p = f.root->promise;
+                    ctx.frames.pop_back();
+
+                    // Forcing the expression, or another thread, may have
+                    // forced the promise already: the first value wins
+                    std::lock_guard<std::mutex> lock(p->lock);
+                    if (!p->is_forced)
+                    {
+                        p->is_forced = true;
+                        p->value = regs.value;
+                        p->expr = nullptr;
+                        p->env = nullptr;
+                    }
+                    set_value(regs, p->value);
+                }
+                break;
+
+            case frame::kind::stream_cons:
+                {
+                    node_ptr root = f.root;
+                    environment_ptr env = f.env;
+                    ctx.frames.pop_back();
+
+                    node_ptr result(std::make_shared<node>());
+                    result->type = node_type::pair;
+                    result->car = regs.value;
+                    result->cdr = make_promise(root->get(2), env);
+                    set_value(regs, result);
+                }
+                break;
+
+            case frame::kind::memo_store:
+                f.proc_node->proc->memo->insert(f.pending, regs.value);
+                ctx.frames.pop_back();
+                break;
+        }
+    }
+
+    void eval_special_form(slist::context& ctx, registers& regs, const slist::node_ptr& root, slist::opcode form)
+    {
+        using namespace slist;
+
+        switch (form)
+        {
+            case opcode::quote:    eval_quote(ctx, regs, root);         break;
+            case opcode::lambda:   eval_lambda(ctx, regs, root);        break;
+            case opcode::define:   eval_define(ctx, regs, root, false); break;
+            case opcode::defmacro: eval_define(ctx, regs, root, true);  break;
+            case opcode::set:      eval_set(ctx, regs, root);           break;
+            case opcode::let:      eval_let(ctx, regs, root, false);    break;
+            case opcode::letrec:   eval_let(ctx, regs, root, true);     break;
+            case opcode::begin:    eval_begin(ctx, regs, root);         break;
+            case opcode::branch:   eval_if(ctx, regs, root);            break;
+            case opcode::delay:    eval_delay(ctx, regs, root);         break;
+            case opcode::stream_cons: eval_stream_cons(ctx, regs, root); break;
+            default:
+                set_value(regs, nullptr);
+                break;
+        }
+    }
+
+    void eval_quote(slist::context& ctx, registers& regs, const slist::node_ptr& root)
+    {
+        using namespace slist;
+
+        if (root->length() != 2)
+        {
+            log_errorln("'quote' expects one argument:\n", root);
+            set_value(regs, nullptr);
+            return;
+        }
+
+        node_ptr arg = root->cdr->car;
+
+        if (arg == nullptr || arg->type != node_type::pair)
+        {
+            set_value(regs, quote_atom(ctx, arg));
+        }
+        else if (is_unquote(arg))
+        {
+            set_expr(regs, arg->cdr->car, regs.env);
+        }
+        else
+        {
+            node_ptr value;
+            if (find_constant(ctx, arg, value))
+            {
+                set_value(regs, value);
+                return;
+            }
+
+            // Templates are copied, sharing their parts without unquote
+            frame& f = push_frame(ctx, frame::kind::quote_list, arg, regs.env);
+            f.pending = arg;
+            advance_quote(ctx, regs);
+        }
+    }
+
+    void eval_lambda(slist::context& ctx, registers& regs, const slist::node_ptr& root)
+    {
+        using namespace slist;
+
+        if (root->length() != 3)
+        {
+            log_errorln("Invalid lambda format\n", root);
+            set_value(regs, nullptr);
+            return;
+        }
+
+        procedure_ptr func(std::make_shared<procedure>());
+        func->env = regs.env;
+        func->name = root->car->value; // "lambda"
+        func->variables = root->get(1);
+        check_shadowing_variables(ctx, func->variables);
+        func->body = root->get(2);
+
+        node_ptr res(std::make_shared<node>());
+        res->proc = func;
+
+        set_value(regs, res);
+    }
+
+    void eval_define(slist::context& ctx, registers& regs, const slist::node_ptr& root, bool is_macro)
+    {
+        using namespace slist;
+
+        if (root->length() < 3)
+        {
+            log_errorln("Invalid arguments for 'define'\n", root);
+            set_value(regs, nullptr);
+            return;
+        }
+
+        node_ptr first = root->get(1);
+        node_ptr body = root->get(2);
+
+        if (first->type == node_type::pair)
+        {
+            // Lambda syntactic sugar
+            // (define (f x) (...)) -> (define f (lambda (x) (...))
+            node_ptr name = first->car;
+
+            procedure_ptr func(std::make_shared<procedure>());
+            func->env = regs.env;
+            func->name = "lambda";
+            func->variables = first->cdr;
+            func->body = body;
+            func->is_macro = is_macro;
+
+            node_ptr lambda(std::make_shared<node>());
+            lambda->proc = func;
+
+            check_shadowing(ctx, name);
+            check_shadowing_variables(ctx, func->variables);
+            regs.env->register_variable(name->value, lambda);
+            set_value(regs, nullptr);
+        }
+        else if (first->type == node_type::name)
+        {
+            check_shadowing(ctx, first);
+            frame& f = push_frame(ctx, frame::kind::bind, root, regs.env);
+            f.pending = first;
+            set_expr(regs, body, regs.env);
+        }
+        else
+        {
+            set_value(regs, nullptr);
+        }
+    }
+
+    void eval_set(slist::context& ctx, registers& regs, const slist::node_ptr& root)
+    {
+        using namespace slist;
+
+        if (root->length() != 3)
+        {
+            log_errorln("Invalid 'set!' syntax: ", root);
+            set_value(regs, nullptr);
+            return;
+        }
+
+        frame& f = push_frame(ctx, frame::kind::assign, root, regs.env);
+        f.pending = root->get(1);
+        check_shadowing(ctx, f.pending);
+        set_expr(regs, root->get(2), regs.env);
+    }
+
+    void eval_let(slist::context& ctx, registers& regs, const slist::node_ptr& root, bool is_rec)
+    {
+        using namespace slist;
+
+        // Let is syntactic sugar:
+        //    (lambda (x)
+        //        (let ((y 2)) (+ x y)))
+        // <-->
+        //    (lambda (x)
+        //        ((lambda (y) (+ x y)) 2))
+        //
+        // Letrec evaluates the values in the new environment, so that
+        // they can refer to each other.
+
+        if (root->length() != 3)
+        {
+            log_errorln(is_rec ? "Invalid 'letrec' syntax: " : "Invalid 'let' syntax: ", root);
+            set_value(regs, nullptr);
+            return;
+        }
+
+        node_ptr bindings = root->get(1);
+        if (bindings == nullptr || bindings->type != node_type::pair)
+        {
+            log_errorln(is_rec ? "Invalid bindings for 'letrec': " : "Invalid bindings for 'let': ", root);
+            set_value(regs, nullptr);
+            return;
+        }
+
+        environment_ptr env = make_environment(ctx, regs.env);
+
+        if (is_rec)
+        {
+            for (node_ptr binding = bindings; binding != nullptr; binding = binding->cdr)
+            {
+                node_ptr var_name = (binding->car != nullptr) ? binding->car->car : nullptr;
+                if (var_name != nullptr && var_name->type == node_type::name)
+                {
+                    check_shadowing(ctx, var_name);
+                    env->register_variable(var_name->value, std::make_shared<node>());
+                }
+            }
+        }
+
+        frame& f = push_frame(ctx, frame::kind::bindings, root, is_rec ? env : regs.env);
+        f.pending = (bindings->car != nullptr) ? bindings : nullptr;
+        f.target = env;
+        advance_bindings(ctx, regs);
+    }
+
+    void eval_begin(slist::context& ctx, registers& regs, const slist::node_ptr& root)
+    {
+        using namespace slist;
 
-        if (root == nullptr)
+        node_ptr n = root->cdr;
+        if (n == nullptr)
         {
-            return nullptr;
+            set_value(regs, nullptr);
+            return;
         }
-        
-        node_ptr result;
 
-        switch (root->type)
+        if (n->cdr != nullptr)
         {
-            case node_type::empty:
-                result = root;
-                break;
-            case node_type::pair:
-                result = eval_list(ctx, root);
-                break;
-            case node_type::name:
-                result = eval_name(ctx, root);
-                break;
-            case node_type::boolean:
-            case node_type::integer:
-            case node_type::number:
-            case node_type::string:
-                result = root;
-            default:
-                break;
+            frame& f = push_frame(ctx, frame::kind::sequence, root, regs.env);
+            f.pending = n->cdr;
         }
+        set_expr(regs, n->car, regs.env);
+    }
+
+    void eval_if(slist::context& ctx, registers& regs, const slist::node_ptr& root)
+    {
+        using namespace slist;
 
-        LOG_TRACELN2("Result of ", root);
-        LOG_TRACELN2(" -> ", result);
-        debug_print_environment(ctx, ctx.active_env);
+        if (root->length() != 4)
+        {
+            log_errorln("Invalid 'if' statement");
+            set_value(regs, nullptr);
+            return;
+        }
 
-        return result;
+        push_frame(ctx, frame::kind::branch, root, regs.env);
+        set_expr(regs, root->get(1), regs.env);
     }
 
-    node_ptr eval_procedure(context& ctx, const node_ptr& proc_node, const node_ptr& args)
+    void eval_delay(slist::context& ctx, registers& regs, const slist::node_ptr& root)
     {
-        if (proc_node == nullptr)
+        using namespace slist;
+
+        if (root->length() != 2)
         {
-            return nullptr;
+            log_errorln("'delay' expects one argument: ", root);
+            set_value(regs, nullptr);
+            return;
         }
 
-        auto proc = proc_node->proc;
+        set_value(regs, make_promise(root->cdr->car, regs.env));
+    }
+
+    void eval_stream_cons(slist::context& ctx, registers& regs, const slist::node_ptr& root)
+    {
+        using namespace slist;
 
-        if (proc == nullptr)
+        // (stream-cons a b) -> (cons a (delay b))
+        if (root->length() != 3)
         {
-            return nullptr;
+            log_errorln("'stream-cons' expects 2 arguments: ", root);
+            set_value(regs, nullptr);
+            return;
         }
 
-        context::callstack_item item;
-        item.node = proc_node;
-        
-        ctx.callstack.push_back(item);        
-        
-        struct auto_pop_callstack
+        push_frame(ctx, frame::kind::stream_cons, root, regs.env);
+        set_expr(regs, root->cdr->car, regs.env);
+    }
+
+    void force_promise(slist::context& ctx, registers& regs, const slist::node_ptr& n)
+    {
+        using namespace slist;
+
+        if (n == nullptr || n->type != node_type::promise)
         {
-            auto_pop_callstack(context& ctx) : ctx(ctx) {}
-            ~auto_pop_callstack() { ctx.callstack.pop_back(); }
-            
-            context& ctx;
-        } auto_stack_popper(ctx);
-        
-        if (proc->is_native)
+            set_value(regs, n);
+            return;
+        }
+
+        const promise_ptr& p = n->promise;
+        node_ptr expr;
+        environment_ptr env;
         {
-            // Build a root node
-            node_ptr name_node(std::make_shared<node>());
-            name_node->type = node_type::name;
-            name_node->value = proc->name;
+            std::lock_guard<std::mutex> lock(p->lock);
+            if (p->is_forced)
+            {
+                set_value(regs, p->value);
+                return;
+            }
+            expr = p->expr;
+            env = p->env;
+        }
 
-            node_ptr root(std::make_shared<node>());
-            root->type = node_type::pair;
-            root->car = name_node;
-            root->cdr = args;
+        push_frame(ctx, frame::kind::force_promise, n, regs.env);
+        set_expr(regs, expr, env);
+    }
 
-            auto prev_env = ctx.active_env; 
-            ctx.active_env = proc->env;
-            auto result = proc->native_func(ctx, root);
-            ctx.active_env = prev_env;
+    void advance_bindings(slist::context& ctx, registers& regs)
+    {
+        using namespace slist;
 
-            return result;
+        frame& f = ctx.frames.back();
+
+        if (f.pending == nullptr)
+        {
+            // All bindings are evaluated, the body is in tail position
+            node_ptr body = f.root->get(2);
+            environment_ptr env = f.target;
+            ctx.frames.pop_back();
+            set_expr(regs, body, env);
+            return;
+        }
+
+        node_ptr name_value = f.pending->car;
+        if (name_value == nullptr || name_value->length() != 2)
+        {
+            log_errorln("Invalid 'let' binding: ", f.pending);
+            ctx.frames.pop_back();
+            set_value(regs, nullptr);
+            return;
+        }
+
+        node_ptr var_name = name_value->car;
+        if (var_name == nullptr || var_name->type != node_type::name)
+        {
+            log_errorln("Invalid variable name in binding: ", name_value);
+            ctx.frames.pop_back();
+            set_value(regs, nullptr);
+            return;
         }
-        else 
+        check_shadowing(ctx, var_name);
+
+        set_expr(regs, name_value->cdr->car, f.env);
+    }
+
+    void advance_quote(slist::context& ctx, registers& regs)
+    {
+        using namespace slist;
+
+        while (true)
         {
-            node_ptr result;
+            frame& f = ctx.frames.back();
 
-            while (proc != nullptr)
+            if (f.pending == nullptr)
             {
-                if (proc->is_tail)
+                node_ptr result = f.head;
+                if (result == nullptr)
                 {
-                    ctx.debug_dump_callstack();
-
-                    LOG_TRACELN2("Trying to unwind the stack:\n", proc->body);
-                    
-                    // Try to unwind the call stack: tail-call elimination
-                    int size = static_cast<int>(ctx.callstack.size());
-                    int i = size-1;
-                    while (i > 0)
-                    {
-                        //auto& item = ctx.callstack[i];
-                        auto& prev_item = ctx.callstack[i-1];
-                        LOG_TRACELN2("    Prev: ", prev_item.node);
-                        if (prev_item.node->is_tail)
-                        {
-                            if (prev_item.node->proc == proc)
-                            {
-                                prev_item.delayed_proc = proc;
-                                prev_item.delayed_args = args;
-                                LOG_TRACELN2("    Unwinding!: ", prev_item.node);
-                                return nullptr;
-                            }
-                            --i;
-                        }
-                        else
-                        {
-                            break;
-                        }
-                    }
+                    result = std::make_shared<node>();
+                    result->type = node_type::pair;
                 }
-                
-                LOG_TRACELN2("Executing procedure:\n", proc->body);
+                ctx.frames.pop_back();
+                set_value(regs, result);
+                return;
+            }
+
+            node_ptr item = f.pending->car;
+            f.pending = f.pending->cdr;
 
-                auto prev_env = ctx.active_env;
-                ctx.active_env = proc->env;
-                result = eval(ctx, proc->body);
-                ctx.active_env = prev_env;
+            if (item == nullptr)
+            {
+                continue;
+            }
 
-                auto prev_proc = proc;
-                
-                auto& back_item = ctx.callstack.back();
-                proc = back_item.delayed_proc;
+            if (item->type == node_type::pair)
+            {
+                if (is_unquote(item))
+                {
+                    set_expr(regs, item->cdr->car, f.env);
+                    return;
+                }
 
-                if (proc != nullptr)
+                node_ptr value;
+                if (find_constant(ctx, item, value))
                 {
-                    context::callstack_item item;
-                    item.node = proc_node;
-                    ctx.callstack.pop_back();
-                    ctx.callstack.push_back(item);
-
-                    proc->env->parent = prev_env;
-                    
-                    LOG_TRACELN("STACK OPTIM!!");
+                    append(f, value);
+                    continue;
                 }
+
+                environment_ptr env = f.env;
+                frame& sub = push_frame(ctx, frame::kind::quote_list, item, env);
+                sub.pending = item;
+                continue;
             }
 
-            return result;
+            append(f, quote_atom(ctx, item));
         }
     }
 
-    node_ptr exec(context& ctx, const std::string& str)
+    bool evaluates_arguments(slist::opcode form)
     {
-        node_ptr result;
-        node_ptr parse_node = parse(str);
-        if (parse_node != nullptr)
+        using namespace slist;
+
+        switch (form)
+        {
+            case opcode::none:
+            case opcode::eval:
+            case opcode::apply:
+            case opcode::force:
+            case opcode::stream_cdr:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    const slist::node_ptr& special_form_node(slist::opcode form)
+    {
+        using namespace slist;
+
+        // Shared by every context: special forms carry no state
+        static const std::vector<node_ptr> nodes = []()
         {
-            while (parse_node != nullptr)
+            std::vector<node_ptr> result;
+            for (int i = 0; i <= static_cast<int>(opcode::stream_cdr); ++i)
             {
-                result = eval(ctx, parse_node->car);
-                parse_node = parse_node->cdr;
+                procedure_ptr f(std::make_shared<procedure>());
+                f->is_native = true;
+                f->form = static_cast<opcode>(i);
+
+                node_ptr n(std::make_shared<node>());
+                n->proc = f;
+                result.push_back(n);
             }
+            return result;
+        }();
+
+        return nodes[static_cast<size_t>(form)];
+    }
+
+    bool is_shadowed(slist::context& ctx, slist::opcode form)
+    {
+        uint32_t mask = ctx.shadowed_forms->load(std::memory_order_relaxed);
+        return (mask & (1u << static_cast<uint32_t>(form))) != 0;
+    }
+
+    void check_shadowing(slist::context& ctx, const slist::node_ptr& name)
+    {
+        using namespace slist;
+
+        if (name != nullptr && name->form != opcode::none && !is_shadowed(ctx, name->form))
+        {
+            ctx.shadow_special_form(name->form);
         }
-        return result;
     }
 
-    node_ptr exec(context& ctx, std::istream& in)
+    void check_shadowing_variables(slist::context& ctx, const slist::node_ptr& variables)
     {
-        std::string s;
+        using namespace slist;
 
-        const size_t size = 1024;
-        char buffer[1024];
-        while (in.read(buffer, size))
+        if (variables != nullptr && variables->type == node_type::name)
         {
-            s.append(buffer, size);
+            check_shadowing(ctx, variables);
+            return;
         }
-        s.append(buffer, in.gcount());
 
-        return exec(ctx, s);
+        for (node *var = variables.get(); var != nullptr; var = var->cdr.get())
+        {
+            check_shadowing(ctx, var->car);
+        }
     }
 
-    node_ptr apply(context& ctx, const node_ptr& args, const node_ptr& proc_node)
+    void observe_call(slist::context& ctx, registers& regs, const slist::node_ptr& proc_node, const slist::node_ptr& args)
+    {
+        using namespace slist;
+
+        // A call made with as many frames as the running call is in tail
+        // position: it takes over that call
+        bool is_tail = ctx.pending_calls.size() > regs.call_base && ctx.pending_calls.back().depth == ctx.frames.size();
+
+        if (ctx.trace != nullptr)
+        {
+            const procedure& proc = *proc_node->proc;
+            if (proc.is_native)
+            {
+                ctx.trace->record(trace_event::native_call, proc.id);
+                if (ctx.observer == nullptr)
+                {
+                    // 'call_native' records the return
+                    return;
+                }
+            }
+            else
+            {
+                ctx.trace->record(is_tail ? trace_event::tail_call : trace_event::call, proc.id);
+            }
+        }
+
+        if (is_tail)
+        {
+            ctx.pending_calls.back().proc_node = proc_node;
+            OBSERVE(ctx, on_tail_call(ctx, proc_node, args));
+            return;
+        }
+
+        context::pending_call call;
+        call.depth = ctx.frames.size();
+        call.proc_node = proc_node;
+        ctx.pending_calls.push_back(std::move(call));
+        OBSERVE(ctx, on_call(ctx, proc_node, args));
+    }
+
+    // Calls made with no fewer frames than there are now have returned
+    // the value computed
+    void observe_returns(slist::context& ctx, registers& regs)
+    {
+        using namespace slist;
+
+        while (ctx.pending_calls.size() > regs.call_base && ctx.pending_calls.back().depth >= ctx.frames.size())
+        {
+            node_ptr proc_node = std::move(ctx.pending_calls.back().proc_node);
+            ctx.pending_calls.pop_back();
+            if (ctx.trace != nullptr)
+            {
+                ctx.trace->record(trace_event::exit, proc_node->proc->id);
+            }
+            OBSERVE(ctx, on_exit(ctx, proc_node, regs.value));
+        }
+    }
+
+    bool bind_arguments(slist::context& ctx, const slist::procedure_ptr& proc, slist::node_ptr arg, slist::environment_ptr& env)
     {
-        auto& proc = proc_node->proc;
+        using namespace slist;
 
-        // Create a new environement to make sure they are not shared between evals
-        environment_ptr env(std::make_shared<environment>());
-        env->parent = proc->env;
-        proc->env = env;
+        // Each call gets its own environment, the procedure keeps its
+        // captured one untouched
+        env = make_environment(ctx, proc->env);
 
         node_ptr var = proc->variables;
-        node_ptr arg = args;
 
         if (var != nullptr && var->type == node_type::name)
         {
             // This is a variadic argument, grab all the args
-            env->register_variable(var->value, args);
+            env->register_variable(var->value, arg);
+            return true;
         }
-        else 
+
+        while (var != nullptr && var->car != nullptr)
         {
-            while (var != nullptr && arg != nullptr)
+            node_ptr var_name = var->car;
+            if (var_name->type != node_type::name)
             {
-                node_ptr var_name = var->car;
-                if (var_name == nullptr || var_name->type != node_type::name)
-                {
-                    log_errorln("Invalid variable:\n", var_name);
-                    return nullptr;
-                }
+                log_errorln("Invalid variable:\n", var_name);
+                return false;
+            }
 
-                if (var_name->value == ".")
+            if (var_name->value == ".")
+            {
+                // The next argument is a variadic one
+                var = var->cdr;
+                if (var == nullptr)
                 {
-                    // The next argument is a variadic one
-                    var = var->cdr;
-                    if (var == nullptr)
-                    {
-                        log_errorln("Missing variadic argument after '.'");
-                        return nullptr;
-                    }
-
-                    var_name = var->car;
-                    if (var_name == nullptr || var_name->type != node_type::name)
-                    {
-                        log_errorln("Invalid variable:\n", var_name);
-                        return nullptr;
-                    }
-
-                    if (proc->is_macro)
-                    {
-                        // Do not evaluate macro arguments
-                        env->register_variable(var_name->value, arg);
-                    }
-                    else 
-                    {
-                        node_ptr list_arg(std::make_shared<node>());
-                        list_arg->type = node_type::pair;
-                        while (arg)
-                        {
-                            list_arg->append(eval(ctx, arg->car));
-                            arg = arg->cdr;
-                        }
-
-                        env->register_variable(var_name->value, list_arg);
-                    }
-                    break;
+                    log_errorln("Missing variadic argument after '.'");
+                    return false;
                 }
 
-                if (proc->is_macro)
-                {
-                    // Do not evaluate macro arguments
-                    env->register_variable(var_name->value, arg->car);
-                }
-                else 
+                var_name = var->car;
+                if (var_name == nullptr || var_name->type != node_type::name)
                 {
-                    env->register_variable(var_name->value, eval(ctx, arg->car));                   
+                    log_errorln("Invalid variable:\n", var_name);
+                    return false;
                 }
 
-                arg = arg->cdr;
-                var = var->cdr;
+                env->register_variable(var_name->value, arg);
+                break;
+            }
+
+            if (arg == nullptr)
+            {
+                break;
             }
+
+            env->register_variable(var_name->value, arg->car);
+
+            arg = arg->cdr;
+            var = var->cdr;
         }
 
-        // LOG_TRACELN("Evaluating Procedure from 'apply':\n", nullptr, proc);
+        return true;
+    }
 
-        if (proc->is_macro)
+    slist::environment_ptr make_environment(slist::context& ctx, const slist::environment_ptr& parent)
+    {
+        using namespace slist;
+
+        environment_ptr env;
+        if (ctx.free_environments.empty())
         {
-            // LOG_TRACELN("Macro root: ", nullptr, proc);
-            node_ptr res = eval_procedure(ctx, proc_node, args);
-            // LOG_TRACELN("Macro res: ", res);
-            return eval(ctx, res);
+            env = std::make_shared<environment>();
         }
-        else 
+        else
         {
-            return eval_procedure(ctx, proc_node, args); 
+            env = std::move(ctx.free_environments.back());
+            ctx.free_environments.pop_back();
         }
+        env->parent = parent;
+        return env;
     }
-}
 
-namespace
-{
-    slist::node_ptr eval_list(slist::context& ctx, const slist::node_ptr& root)
+    void release_environment(slist::context& ctx, slist::environment_ptr& env)
     {
         using namespace slist;
 
-        if (root->length() == 0)
+        // Only the registers hold it: no closure, promise or frame
+        // captured it, and nothing can see it being reused
+        const size_t max_free_environments = 64;
+        if (env != nullptr && env.use_count() == 1 && !env->is_global &&
+            ctx.free_environments.size() < max_free_environments)
         {
-            log_errorln("List is empty", root);
-            return nullptr;
+            env->bindings.clear();
+            env->parent = nullptr;
+            ctx.free_environments.push_back(std::move(env));
         }
+        env = nullptr;
+    }
 
-        node_ptr op_node = root->get(0);
-        if (op_node == nullptr)
+    bool is_unquote(const slist::node_ptr& n)
+    {
+        using namespace slist;
+
+        return n->car != nullptr &&
+               n->car->type == node_type::name &&
+               n->car->value == "unquote" &&
+               n->cdr != nullptr &&
+               n->cdr->cdr == nullptr;
+    }
+
+    slist::node_ptr quote_atom(slist::context& ctx, const slist::node_ptr& n)
+    {
+        using namespace slist;
+
+        if (n != nullptr && n->type == node_type::name)
         {
-            log_errorln("Cannot evaluate empty list.");
-            return nullptr;
+            return ctx.intern_symbol(n);
         }
+        return n;
+    }
+
+    // Returns false for templates, which contain unquotes
+    bool find_constant(slist::context& ctx, const slist::node_ptr& datum, slist::node_ptr& value)
+    {
+        using namespace slist;
 
-        node_ptr proc_node = op_node;
-        procedure_ptr proc = proc_node->proc;
+        if (ctx.constants == nullptr)
+        {
+            ctx.constants = std::make_shared<constant_pool>();
+        }
+        constant_pool& pool = *ctx.constants;
 
-        if (proc == nullptr && op_node->type == node_type::pair)
+        // An expired entry is for a freed datum that had the same address
+        auto it = pool.entries.find(datum.get());
+        if (it == pool.entries.end() || it->second.datum.expired())
         {
-            node_ptr eval_node = eval(ctx, op_node);
-            if (eval_node == nullptr || eval_node->proc == nullptr)
+            if (pool.entries.size() >= pool.purge_size)
             {
-                log_errorln("Error: first argument is not a procedure", root);
-                return nullptr;
+                // Forget the quotes of code that is gone, such as macro
+                // expansions
+                for (auto entry = pool.entries.begin(); entry != pool.entries.end(); )
+                {
+                    entry = entry->second.datum.expired() ? pool.entries.erase(entry) : std::next(entry);
+                }
+                pool.purge_size = std::max(pool.purge_size, 2 * pool.entries.size());
             }
-            proc_node = eval_node;
-            proc = eval_node->proc;
+
+            constant_pool::entry& entry = pool.entries[datum.get()];
+            entry.datum = datum;
+            entry.value = make_constant(ctx, datum);
+            value = entry.value;
         }
         else
         {
-            // Look in environment
-            node_ptr val = ctx.active_env->lookup_variable(op_node->value);
-            if (val != nullptr && val->proc != nullptr)
+            value = it->second.value;
+        }
+
+        return value != nullptr;
+    }
+
+    // Copies 'datum' with its symbols interned, like evaluating the quote
+    // would, or returns nullptr if it contains an unquote
+    slist::node_ptr make_constant(slist::context& ctx, const slist::node_ptr& datum)
+    {
+        using namespace slist;
+
+        struct level
+        {
+            node *pending;
+            list_builder items;
+        };
+
+        std::vector<level> levels;
+        levels.push_back(level{ datum.get(), list_builder() });
+
+        while (true)
+        {
+            level& top = levels.back();
+
+            if (top.pending == nullptr)
+            {
+                node_ptr value = top.items.head;
+                for (node *n = value.get(); n != nullptr; n = n->cdr.get())
+                {
+                    n->is_constant = true;
+                }
+
+                levels.pop_back();
+                if (levels.empty())
+                {
+                    return value;
+                }
+                levels.back().items.append(value);
+                continue;
+            }
+
+            node_ptr item = top.pending->car;
+            top.pending = top.pending->cdr.get();
+
+            if (item == nullptr)
             {
-                proc_node = val;
-                proc_node->is_tail = root->is_tail;
-                proc = val->proc;
-                if (proc != nullptr && proc->is_native)
+                continue;
+            }
+
+            if (item->type == node_type::pair)
+            {
+                if (is_unquote(item))
                 {
-                    return proc->native_func(ctx, root);
+                    return nullptr;
                 }
+                levels.push_back(level{ item.get(), list_builder() });
+                continue;
             }
+
+            top.items.append(quote_atom(ctx, item));
+        }
+    }
+
+    slist::node_ptr make_promise(const slist::node_ptr& expr, const slist::environment_ptr& env)
+    {
+        using namespace slist;
+
+        node_ptr result(std::make_shared<node>());
+        result->type = node_type::promise;
+        result->promise = std::make_shared<promise>();
+        result->promise->expr = expr;
+        result->promise->env = env;
+        return result;
+    }
+
+    frame& push_frame(slist::context& ctx, frame::kind type, const slist::node_ptr& root, const slist::environment_ptr& env)
+    {
+        using namespace slist;
+
+        if ((ctx.frames.size() + 1) * sizeof(frame) > ctx.stack_size_limit)
+        {
+            throw stack_overflow_error("Stack overflow: evaluation stack exceeds " +
+                                       std::to_string(ctx.stack_size_limit) + " bytes");
         }
 
-        if (proc != nullptr)
+        ctx.frames.emplace_back();
+        frame& f = ctx.frames.back();
+        f.type = type;
+        f.root = root;
+        f.env = env;
+        return f;
+    }
+
+    void append(frame& f, const slist::node_ptr& value)
+    {
+        using namespace slist;
+
+        node_ptr cell(std::make_shared<node>());
+        cell->type = node_type::pair;
+        cell->car = value;
+
+        if (f.tail != nullptr)
         {
-            return apply(ctx, root->cdr, proc_node);
+            f.tail->cdr = cell;
         }
+        else
+        {
+            f.head = cell;
+        }
+        f.tail = cell;
+    }
 
-        log_errorln("Operator is not a procedure: ", op_node);
+    void set_expr(registers& regs, const slist::node_ptr& expr, const slist::environment_ptr& env)
+    {
+        // 'expr' and 'env' may alias the registers
+        slist::node_ptr e = expr;
+        regs.env = env;
+        regs.expr = std::move(e);
+        regs.value = nullptr;
+        regs.has_value = false;
+    }
 
-        return nullptr;
+    void set_value(registers& regs, const slist::node_ptr& value)
+    {
+        slist::node_ptr v = value;
+        regs.value = std::move(v);
+        regs.expr = nullptr;
+        regs.has_value = true;
     }
 
-    slist::node_ptr eval_name(slist::context& ctx, const slist::node_ptr& root)
+    slist::node_ptr eval_forms(slist::context& ctx, slist::form_reader& reader, std::streambuf *input)
     {
-        using namespace slist;
-        auto var_node = ctx.active_env->lookup_variable(root->value);
-        if (var_node == nullptr)
+        // The limits apply to the whole execution
+        run_guard guard(ctx);
+
+        // Each form is released when the next one is read
+        slist::node_ptr result;
+        slist::node_ptr form;
+        while (reader.next(form))
         {
-            log_errorln("Could not evaluate variable: ", root);
-            return nullptr;
+            result = eval(ctx, form);
+
+            // The output so far is shown before waiting for more input
+            if (input != nullptr && input->in_avail() <= 0)
+            {
+                ctx.log.out->flush();
+            }
         }
-        return var_node;
+        return result;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,160 @@
+#include "slist_file.h"
+
+#include <fstream>
+#include <iterator>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char *map_file(const std::string& path, slist::file_access access, size_t& length, bool& is_open);
+    void unmap_file(const char *begin, size_t length);
+}
+
+namespace slist
+{
+    mapped_file::mapped_file()
+        : begin(nullptr)
+        , length(0)
+        , is_mapped(false)
+    {
+    }
+
+    mapped_file::~mapped_file()
+    {
+        close();
+    }
+
+    bool mapped_file::open(const std::string& path, file_access access)
+    {
+        close();
+
+        bool is_open = false;
+        begin = map_file(path, access, length, is_open);
+        if (begin != nullptr)
+        {
+            is_mapped = true;
+            return true;
+        }
+        if (!is_open)
+        {
+            return false;
+        }
+
+        // Empty files, or no mmap: read it
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+        {
+            return false;
+        }
+
+        buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        begin = buffer.data();
+        length = buffer.size();
+        return true;
+    }
+
+    void mapped_file::close()
+    {
+        if (is_mapped)
+        {
+            unmap_file(begin, length);
+        }
+        begin = nullptr;
+        length = 0;
+        is_mapped = false;
+        buffer.clear();
+    }
+}
+
+namespace
+{
+    // Returns the mapping, or nullptr with 'is_open' telling whether the
+    // file exists but could not be mapped
+#if defined(_WIN32)
+    const char *map_file(const std::string& path, slist::file_access access, size_t& length, bool& is_open)
+    {
+        DWORD flags = FILE_ATTRIBUTE_NORMAL;
+        if (access == slist::file_access::sequential)
+        {
+            flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+        }
+
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            is_open = false;
+            return nullptr;
+        }
+        is_open = true;
+
+        const char *result = nullptr;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        {
+            // The view keeps the mapping alive once both handles are closed
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr)
+            {
+                result = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                length = static_cast<size_t>(size.QuadPart);
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+        return result;
+    }
+
+    void unmap_file(const char *begin, size_t)
+    {
+        UnmapViewOfFile(begin);
+    }
+#else
+    const char *map_file(const std::string& path, slist::file_access access, size_t& length, bool& is_open)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            is_open = false;
+            return nullptr;
+        }
+        is_open = true;
+
+        const char *result = nullptr;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            size_t size = static_cast<size_t>(st.st_size);
+            void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                if (access == slist::file_access::sequential)
+                {
+                    // More read-ahead, and pages already read can be
+                    // dropped first under memory pressure
+                    madvise(p, size, MADV_SEQUENTIAL);
+                }
+                result = static_cast<const char *>(p);
+                length = size;
+            }
+        }
+        ::close(fd);
+        return result;
+    }
+
+    void unmap_file(const char *begin, size_t length)
+    {
+        munmap(const_cast<char *>(begin), length);
+    }
+#endif
+}
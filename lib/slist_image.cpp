@@ -0,0 +1,920 @@
+#include "slist_image.h"
+#include "slist_context.h"
+#include "slist_log.h"
+#include "slist_memo.h"
+
+#include <cstring>
+#include <fstream>
+
+// Image layout, little-endian:
+//
+//   "SLISTIMG" u32 version u32 object_count u32 binding_count u32 symbol_count
+//              u32 shadowed_forms
+//   bindings:  (string name, ref value) * binding_count
+//   symbols:   ref * symbol_count
+//   offsets:   u32 * object_count, from the start of the objects
+//   objects:   u8 tag followed by the fields of the object
+//
+// Strings are a u32 length followed by the characters.  A ref is the
+// index of an object plus one, 0 being nullptr.
+
+namespace
+{
+    const char image_magic[8] = { 'S', 'L', 'I', 'S', 'T', 'I', 'M', 'G' };
+    const uint32_t image_version = 2;
+
+    enum class tag : uint8_t
+    {
+        node = 1,           // type, value, car, cdr, proc, promise
+        procedure,          // name, flags, form, variables, body, env, memo target, memo capacity
+        native,             // name, linked to the native registered under that name
+        environment,        // parent, count, (name, value) * count
+        global_environment, // The global environment of the loading context
+        promise,            // is_forced, value, expr, env
+    };
+
+    enum procedure_flags : uint8_t
+    {
+        flag_macro  = 1,
+        flag_strict = 2,
+        flag_memo   = 4,
+    };
+
+    class image_writer
+    {
+    public:
+        explicit image_writer(slist::context& ctx);
+
+        bool write(const std::string& path);
+
+    private:
+        uint32_t ref(const void *p, tag t);
+        uint32_t ref(const slist::node_ptr& n);
+        uint32_t ref(const slist::procedure_ptr& p);
+        uint32_t ref(const slist::environment_ptr& env);
+        uint32_t ref(const slist::promise_ptr& pr);
+
+        bool write_object(size_t index);
+
+        void put(std::string& out, uint8_t value);
+        void put(std::string& out, uint32_t value);
+        void put(std::string& out, const std::string& value);
+
+        struct object
+        {
+            tag type;
+            const void *p;
+        };
+
+        slist::context& ctx;
+        std::unordered_map<const void *, uint32_t> index;
+        std::vector<object> objects;
+
+        std::unordered_map<const slist::procedure *, std::string> natives;
+
+        std::string data;
+        std::vector<uint32_t> offsets;
+    };
+}
+
+namespace slist
+{
+    bool dump_image(context& ctx, const std::string& path)
+    {
+        image_writer writer(ctx);
+        return writer.write(path);
+    }
+
+    bool load_image(context& ctx, const std::string& path)
+    {
+        image_ptr img(std::make_shared<image>());
+        if (!img->open(ctx, path))
+        {
+            return false;
+        }
+
+        ctx.global_env->image = img;
+        return true;
+    }
+
+    image::image()
+        : offsets(nullptr)
+        , objects(nullptr)
+        , object_count(0)
+    {
+    }
+
+    bool image::open(context& ctx, const std::string& path)
+    {
+        if (!file.open(path))
+        {
+            log_errorln("Cannot open image: ", path);
+            return false;
+        }
+
+        cursor c;
+        c.p = file.data();
+        c.end = file.data() + file.size();
+
+        uint32_t version = 0;
+        uint32_t binding_count = 0;
+        uint32_t symbol_count = 0;
+        uint32_t shadowed_forms = 0;
+        if (file.size() < sizeof(image_magic) ||
+            memcmp(c.p, image_magic, sizeof(image_magic)) != 0)
+        {
+            log_errorln("Not an image: ", path);
+            return false;
+        }
+        c.p += sizeof(image_magic);
+
+        if (!c.read(version) || version != image_version)
+        {
+            log_errorln("Unsupported image version: ", path);
+            return false;
+        }
+
+        if (!c.read(object_count) || !c.read(binding_count) || !c.read(symbol_count) ||
+            !c.read(shadowed_forms))
+        {
+            log_errorln("Truncated image: ", path);
+            return false;
+        }
+
+        for (uint32_t i = 0; i < binding_count; ++i)
+        {
+            std::string name;
+            uint32_t ref = 0;
+            if (!c.read(name) || !c.read(ref))
+            {
+                log_errorln("Truncated image: ", path);
+                return false;
+            }
+            bindings[name] = ref;
+        }
+
+        const char *symbols = c.p;
+        if (static_cast<size_t>(c.end - c.p) / sizeof(uint32_t) < symbol_count + static_cast<size_t>(object_count))
+        {
+            log_errorln("Truncated image: ", path);
+            return false;
+        }
+        offsets = symbols + symbol_count * sizeof(uint32_t);
+        objects = offsets + object_count * sizeof(uint32_t);
+
+        nodes.resize(object_count);
+        procedures.resize(object_count);
+        environments.resize(object_count);
+        promises.resize(object_count);
+
+        // Natives are linked by name to the ones of the loading context.
+        // Its other globals are replaced by the ones of the image, once it
+        // is known to be valid.
+        global_env = ctx.global_env;
+        for (auto& keyval : ctx.global_env->bindings)
+        {
+            const node_ptr& n = keyval.second;
+            if (n != nullptr && n->proc != nullptr && n->proc->is_native)
+            {
+                natives[n->proc->name] = n->proc;
+            }
+        }
+
+        if (!validate(symbols, symbol_count))
+        {
+            log_errorln("Corrupted image: ", path);
+            return false;
+        }
+
+        for (auto& keyval : bindings)
+        {
+            ctx.global_env->bindings.erase(keyval.first);
+        }
+
+        // Procedures of the image may bind the names of special forms
+        *ctx.shadowed_forms |= shadowed_forms;
+
+        cursor sc;
+        sc.p = symbols;
+        sc.end = offsets;
+        for (uint32_t i = 0; i < symbol_count; ++i)
+        {
+            uint32_t ref = 0;
+            sc.read(ref);
+            node_ptr symbol = get_node(ref);
+            fill_pending();
+            if (symbol != nullptr && symbol->type == node_type::name)
+            {
+                ctx.symbols[symbol->value] = symbol;
+            }
+        }
+
+        return true;
+    }
+
+    bool image::take(const std::string& name, node_ptr& value)
+    {
+        auto it = bindings.find(name);
+        if (it == bindings.end())
+        {
+            return false;
+        }
+
+        value = get_node(it->second);
+        fill_pending();
+        bindings.erase(it);
+        return true;
+    }
+
+    void image::take_all(std::unordered_map<std::string, node_ptr>& env_bindings)
+    {
+        for (auto& keyval : bindings)
+        {
+            if (env_bindings.find(keyval.first) == env_bindings.end())
+            {
+                env_bindings[keyval.first] = get_node(keyval.second);
+            }
+        }
+        fill_pending();
+        bindings.clear();
+    }
+
+    bool image::cursor::read(uint8_t& value)
+    {
+        if (end - p < 1)
+        {
+            return false;
+        }
+        value = static_cast<uint8_t>(*p++);
+        return true;
+    }
+
+    bool image::cursor::read(uint32_t& value)
+    {
+        if (end - p < 4)
+        {
+            return false;
+        }
+        const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+        value = static_cast<uint32_t>(u[0]) |
+                static_cast<uint32_t>(u[1]) << 8 |
+                static_cast<uint32_t>(u[2]) << 16 |
+                static_cast<uint32_t>(u[3]) << 24;
+        p += 4;
+        return true;
+    }
+
+    bool image::cursor::read(std::string& value)
+    {
+        uint32_t length = 0;
+        if (!read(length) || static_cast<size_t>(end - p) < length)
+        {
+            return false;
+        }
+        value.assign(p, length);
+        p += length;
+        return true;
+    }
+
+    bool image::object_cursor(uint32_t ref, cursor& c) const
+    {
+        if (ref == 0 || ref > object_count)
+        {
+            return false;
+        }
+
+        cursor oc;
+        oc.p = offsets + (ref - 1) * sizeof(uint32_t);
+        oc.end = objects;
+
+        uint32_t offset = 0;
+        oc.read(offset);
+        if (offset >= static_cast<size_t>(file.data() + file.size() - objects))
+        {
+            return false;
+        }
+
+        c.p = objects + offset;
+        c.end = file.data() + file.size();
+        return true;
+    }
+
+    bool image::validate(const char *symbols, uint32_t symbol_count) const
+    {
+        const uint8_t node = static_cast<uint8_t>(tag::node);
+        for (auto& keyval : bindings)
+        {
+            if (keyval.second != 0 && !is_ref(keyval.second, node))
+            {
+                return false;
+            }
+        }
+
+        cursor sc;
+        sc.p = symbols;
+        sc.end = offsets;
+        for (uint32_t i = 0; i < symbol_count; ++i)
+        {
+            uint32_t ref = 0;
+            if (!sc.read(ref) || !is_ref(ref, node))
+            {
+                return false;
+            }
+        }
+
+        for (uint32_t ref = 1; ref <= object_count; ++ref)
+        {
+            if (!validate_object(ref))
+            {
+                log_errorln("Corrupted image object: ", ref - 1);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool image::validate_object(uint32_t ref) const
+    {
+        const uint8_t node = static_cast<uint8_t>(tag::node);
+        const uint8_t procedure = static_cast<uint8_t>(tag::procedure);
+        const uint8_t native = static_cast<uint8_t>(tag::native);
+        const uint8_t environment = static_cast<uint8_t>(tag::environment);
+        const uint8_t global_environment = static_cast<uint8_t>(tag::global_environment);
+        const uint8_t promise = static_cast<uint8_t>(tag::promise);
+
+        cursor c;
+        uint8_t t = 0;
+        if (!object_cursor(ref, c) || !c.read(t))
+        {
+            return false;
+        }
+
+        // Refs may be 0 for nullptr, except for the target of a memo cache
+        switch (static_cast<tag>(t))
+        {
+            case tag::node:
+                {
+                    uint8_t type = 0;
+                    std::string value;
+                    uint32_t car = 0, cdr = 0, proc = 0, pr = 0;
+                    return c.read(type) && c.read(value) &&
+                           c.read(car) && c.read(cdr) && c.read(proc) && c.read(pr) &&
+                           type <= static_cast<uint8_t>(node_type::promise) &&
+                           (car == 0 || is_ref(car, node)) &&
+                           (cdr == 0 || is_ref(cdr, node)) &&
+                           (proc == 0 || is_ref(proc, procedure, native)) &&
+                           (pr == 0 ? type != static_cast<uint8_t>(node_type::promise) : is_ref(pr, promise));
+                }
+
+            case tag::procedure:
+                {
+                    std::string name;
+                    uint8_t flags = 0, form = 0;
+                    uint32_t variables = 0, body = 0, env = 0, memo_target = 0, memo_capacity = 0;
+                    if (!c.read(name) || !c.read(flags) || !c.read(form) ||
+                        !c.read(variables) || !c.read(body) || !c.read(env) ||
+                        !c.read(memo_target) || !c.read(memo_capacity) ||
+                        form > static_cast<uint8_t>(opcode::stream_cdr) ||
+                        (variables != 0 && !is_ref(variables, node)) ||
+                        (body != 0 && !is_ref(body, node)) ||
+                        (env != 0 && !is_ref(env, environment, global_environment)))
+                    {
+                        return false;
+                    }
+
+                    if ((flags & flag_memo) == 0)
+                    {
+                        return true;
+                    }
+
+                    // Calls are forwarded to the target, which must be a
+                    // node holding a procedure
+                    cursor tc;
+                    uint8_t target_tag = 0, type = 0;
+                    std::string value;
+                    uint32_t car = 0, cdr = 0, proc = 0;
+                    return memo_capacity > 0 &&
+                           object_cursor(memo_target, tc) && tc.read(target_tag) &&
+                           target_tag == node &&
+                           tc.read(type) && tc.read(value) &&
+                           tc.read(car) && tc.read(cdr) && tc.read(proc) &&
+                           proc != 0;
+                }
+
+            case tag::native:
+                {
+                    std::string name;
+                    if (!c.read(name))
+                    {
+                        return false;
+                    }
+                    if (natives.find(name) == natives.end())
+                    {
+                        log_errorln("Native procedure of the image is not registered: ", name);
+                        return false;
+                    }
+                    return true;
+                }
+
+            case tag::environment:
+                {
+                    uint32_t parent = 0, count = 0;
+                    if (!c.read(parent) || !c.read(count) ||
+                        (parent != 0 && !is_ref(parent, environment, global_environment)))
+                    {
+                        return false;
+                    }
+                    for (uint32_t i = 0; i < count; ++i)
+                    {
+                        std::string name;
+                        uint32_t value = 0;
+                        if (!c.read(name) || !c.read(value) ||
+                            (value != 0 && !is_ref(value, node)))
+                        {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+
+            case tag::global_environment:
+                return true;
+
+            case tag::promise:
+                {
+                    uint8_t is_forced = 0;
+                    uint32_t value = 0, expr = 0, env = 0;
+                    return c.read(is_forced) && c.read(value) && c.read(expr) && c.read(env) &&
+                           (value == 0 || is_ref(value, node)) &&
+                           (expr == 0 || is_ref(expr, node)) &&
+                           (env == 0 || is_ref(env, environment, global_environment));
+                }
+
+            default:
+                return false;
+        }
+    }
+
+    // Whether 'ref' is an object with the tag 't1', or 't2' if not 0
+    bool image::is_ref(uint32_t ref, uint8_t t1, uint8_t t2) const
+    {
+        cursor c;
+        uint8_t t = 0;
+        return object_cursor(ref, c) && c.read(t) && (t == t1 || (t2 != 0 && t == t2));
+    }
+
+    // Objects are created empty, and filled by 'fill_pending', so that
+    // decoding long lists or cycles does not recurse
+
+    node_ptr image::get_node(uint32_t ref)
+    {
+        if (ref == 0 || ref > object_count)
+        {
+            return nullptr;
+        }
+
+        node_ptr& n = nodes[ref - 1];
+        if (n == nullptr)
+        {
+            n = std::make_shared<node>();
+            pending.push_back(ref);
+        }
+        return n;
+    }
+
+    procedure_ptr image::get_procedure(uint32_t ref)
+    {
+        cursor c;
+        uint8_t t = 0;
+        if (!object_cursor(ref, c) || !c.read(t))
+        {
+            return nullptr;
+        }
+
+        procedure_ptr& p = procedures[ref - 1];
+        if (p != nullptr)
+        {
+            return p;
+        }
+
+        if (t == static_cast<uint8_t>(tag::native))
+        {
+            std::string name;
+            c.read(name);
+            auto it = natives.find(name);
+            if (it == natives.end())
+            {
+                log_errorln("Native procedure of the image is not registered: ", name);
+                return nullptr;
+            }
+            p = it->second;
+            return p;
+        }
+
+        p = std::make_shared<procedure>();
+        pending.push_back(ref);
+        return p;
+    }
+
+    environment_ptr image::get_environment(uint32_t ref)
+    {
+        cursor c;
+        uint8_t t = 0;
+        if (!object_cursor(ref, c) || !c.read(t))
+        {
+            return nullptr;
+        }
+
+        if (t == static_cast<uint8_t>(tag::global_environment))
+        {
+            return global_env.lock();
+        }
+
+        environment_ptr& env = environments[ref - 1];
+        if (env == nullptr)
+        {
+            env = std::make_shared<environment>();
+            pending.push_back(ref);
+        }
+        return env;
+    }
+
+    promise_ptr image::get_promise(uint32_t ref)
+    {
+        if (ref == 0 || ref > object_count)
+        {
+            return nullptr;
+        }
+
+        promise_ptr& pr = promises[ref - 1];
+        if (pr == nullptr)
+        {
+            pr = std::make_shared<promise>();
+            pending.push_back(ref);
+        }
+        return pr;
+    }
+
+    void image::fill_pending()
+    {
+        while (!pending.empty())
+        {
+            uint32_t ref = pending.back();
+            pending.pop_back();
+
+            if (!fill(ref))
+            {
+                log_errorln("Corrupted image object: ", ref - 1);
+            }
+        }
+    }
+
+    bool image::fill(uint32_t ref)
+    {
+        cursor c;
+        uint8_t t = 0;
+        if (!object_cursor(ref, c) || !c.read(t))
+        {
+            return false;
+        }
+
+        // The object must have been created with the type of its record
+        size_t index = ref - 1;
+        switch (static_cast<tag>(t))
+        {
+            case tag::node:
+                if (nodes[index] == nullptr)
+                {
+                    return false;
+                }
+                {
+                    node& n = *nodes[index];
+                    uint8_t type = 0;
+                    uint32_t car = 0, cdr = 0, proc = 0, pr = 0;
+                    if (!c.read(type) || !c.read(n.value) ||
+                        !c.read(car) || !c.read(cdr) || !c.read(proc) || !c.read(pr) ||
+                        type > static_cast<uint8_t>(node_type::promise))
+                    {
+                        return false;
+                    }
+                    n.type = static_cast<node_type>(type);
+                    if (n.type == node_type::name)
+                    {
+                        n.form = find_special_form(n.value);
+                    }
+                    n.car = get_node(car);
+                    n.cdr = get_node(cdr);
+                    n.proc = get_procedure(proc);
+                    n.promise = get_promise(pr);
+                }
+                return true;
+
+            case tag::procedure:
+                if (procedures[index] == nullptr)
+                {
+                    return false;
+                }
+                {
+                    procedure& p = *procedures[index];
+                    uint8_t flags = 0, form = 0;
+                    uint32_t variables = 0, body = 0, env = 0, memo_target = 0, memo_capacity = 0;
+                    if (!c.read(p.name) || !c.read(flags) || !c.read(form) ||
+                        !c.read(variables) || !c.read(body) || !c.read(env) ||
+                        !c.read(memo_target) || !c.read(memo_capacity) ||
+                        form > static_cast<uint8_t>(opcode::stream_cdr))
+                    {
+                        return false;
+                    }
+                    p.is_macro = (flags & flag_macro) != 0;
+                    p.is_strict = (flags & flag_strict) != 0;
+                    p.form = static_cast<opcode>(form);
+                    p.variables = get_node(variables);
+                    p.body = get_node(body);
+                    p.env = get_environment(env);
+                    if (flags & flag_memo)
+                    {
+                        p.memo = std::make_shared<memo_cache>(get_node(memo_target), memo_capacity);
+                    }
+                }
+                return true;
+
+            case tag::environment:
+                if (environments[index] == nullptr)
+                {
+                    return false;
+                }
+                {
+                    environment& env = *environments[index];
+                    uint32_t parent = 0, count = 0;
+                    if (!c.read(parent) || !c.read(count))
+                    {
+                        return false;
+                    }
+                    env.parent = get_environment(parent);
+                    for (uint32_t i = 0; i < count; ++i)
+                    {
+                        std::string name;
+                        uint32_t value = 0;
+                        if (!c.read(name) || !c.read(value))
+                        {
+                            return false;
+                        }
+                        env.bindings[name] = get_node(value);
+                    }
+                }
+                return true;
+
+            case tag::promise:
+                if (promises[index] == nullptr)
+                {
+                    return false;
+                }
+                {
+                    promise& pr = *promises[index];
+                    uint8_t is_forced = 0;
+                    uint32_t value = 0, expr = 0, env = 0;
+                    if (!c.read(is_forced) || !c.read(value) || !c.read(expr) || !c.read(env))
+                    {
+                        return false;
+                    }
+                    pr.is_forced = is_forced != 0;
+                    pr.value = get_node(value);
+                    pr.expr = get_node(expr);
+                    pr.env = get_environment(env);
+                }
+                return true;
+
+            default:
+                return false;
+        }
+    }
+}
+
+namespace
+{
+    image_writer::image_writer(slist::context& ctx)
+        : ctx(ctx)
+    {
+    }
+
+    bool image_writer::write(const std::string& path)
+    {
+        using namespace slist;
+
+        // Globals of a fork override the ones it shares with its parents
+        ctx.global_env->load_image_bindings();
+
+        std::vector<environment *> chain;
+        for (environment *env = ctx.global_env.get(); env != nullptr && env->is_global; env = env->parent.get())
+        {
+            chain.push_back(env);
+        }
+
+        environment::var_map globals;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+        {
+            for (auto& keyval : (*it)->bindings)
+            {
+                globals[keyval.first] = keyval.second;
+            }
+        }
+
+        // Natives can only be linked back if they are registered by name
+        for (auto& keyval : globals)
+        {
+            const node_ptr& n = keyval.second;
+            if (n != nullptr && n->proc != nullptr && n->proc->is_native && n->proc->name == keyval.first)
+            {
+                natives[n->proc.get()] = keyval.first;
+            }
+        }
+
+        std::string header(image_magic, sizeof(image_magic));
+        put(header, image_version);
+
+        std::string tables;
+        for (auto& keyval : globals)
+        {
+            put(tables, keyval.first);
+            put(tables, ref(keyval.second));
+        }
+        for (auto& keyval : ctx.symbols)
+        {
+            put(tables, ref(keyval.second));
+        }
+
+        // Writing an object adds the ones it refers to
+        for (size_t i = 0; i < objects.size(); ++i)
+        {
+            offsets.push_back(static_cast<uint32_t>(data.size()));
+            if (!write_object(i))
+            {
+                return false;
+            }
+        }
+
+        put(header, static_cast<uint32_t>(objects.size()));
+        put(header, static_cast<uint32_t>(globals.size()));
+        put(header, static_cast<uint32_t>(ctx.symbols.size()));
+        put(header, static_cast<uint32_t>(*ctx.shadowed_forms));
+
+        for (uint32_t offset : offsets)
+        {
+            put(tables, offset);
+        }
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << header << tables << data;
+        out.flush();
+        if (!out)
+        {
+            log_errorln("Cannot write image: ", path);
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t image_writer::ref(const void *p, tag t)
+    {
+        if (p == nullptr)
+        {
+            return 0;
+        }
+
+        auto it = index.find(p);
+        if (it != index.end())
+        {
+            return it->second;
+        }
+
+        objects.push_back({ t, p });
+        uint32_t r = static_cast<uint32_t>(objects.size());
+        index[p] = r;
+        return r;
+    }
+
+    uint32_t image_writer::ref(const slist::node_ptr& n)
+    {
+        return ref(n.get(), tag::node);
+    }
+
+    uint32_t image_writer::ref(const slist::procedure_ptr& p)
+    {
+        return ref(p.get(), (p != nullptr && p->is_native) ? tag::native : tag::procedure);
+    }
+
+    uint32_t image_writer::ref(const slist::environment_ptr& env)
+    {
+        if (env != nullptr && env->is_global)
+        {
+            // Every global environment is the one of the loading context
+            return ref(ctx.global_env.get(), tag::global_environment);
+        }
+        return ref(env.get(), tag::environment);
+    }
+
+    uint32_t image_writer::ref(const slist::promise_ptr& pr)
+    {
+        return ref(pr.get(), tag::promise);
+    }
+
+    bool image_writer::write_object(size_t i)
+    {
+        using namespace slist;
+
+        const object obj = objects[i];
+        put(data, static_cast<uint8_t>(obj.type));
+
+        switch (obj.type)
+        {
+            case tag::node:
+                {
+                    const node& n = *static_cast<const node *>(obj.p);
+                    put(data, static_cast<uint8_t>(n.type));
+                    put(data, n.value);
+                    put(data, ref(n.car));
+                    put(data, ref(n.cdr));
+                    put(data, ref(n.proc));
+                    put(data, ref(n.promise));
+                }
+                return true;
+
+            case tag::procedure:
+                {
+                    const procedure& p = *static_cast<const procedure *>(obj.p);
+                    uint8_t flags = (p.is_macro ? flag_macro : 0) |
+                                    (p.is_strict ? flag_strict : 0) |
+                                    (p.memo != nullptr ? flag_memo : 0);
+                    put(data, p.name);
+                    put(data, flags);
+                    put(data, static_cast<uint8_t>(p.form));
+                    put(data, ref(p.variables));
+                    put(data, ref(p.body));
+                    put(data, ref(p.env));
+                    put(data, p.memo != nullptr ? ref(p.memo->target) : 0);
+                    put(data, p.memo != nullptr ? static_cast<uint32_t>(p.memo->capacity) : 0);
+                }
+                return true;
+
+            case tag::native:
+                {
+                    auto it = natives.find(static_cast<const procedure *>(obj.p));
+                    if (it == natives.end())
+                    {
+                        log_errorln("Cannot save a native procedure that is not registered: ",
+                                    static_cast<const procedure *>(obj.p)->name);
+                        return false;
+                    }
+                    put(data, it->second);
+                }
+                return true;
+
+            case tag::environment:
+                {
+                    const environment& env = *static_cast<const environment *>(obj.p);
+                    put(data, ref(env.parent));
+                    put(data, static_cast<uint32_t>(env.bindings.size()));
+                    for (auto& keyval : env.bindings)
+                    {
+                        put(data, keyval.first);
+                        put(data, ref(keyval.second));
+                    }
+                }
+                return true;
+
+            case tag::global_environment:
+                return true;
+
+            case tag::promise:
+                {
+                    const promise& pr = *static_cast<const promise *>(obj.p);
+                    put(data, static_cast<uint8_t>(pr.is_forced ? 1 : 0));
+                    put(data, ref(pr.value));
+                    put(data, ref(pr.expr));
+                    put(data, ref(pr.env));
+                }
+                return true;
+        }
+
+        return false;
+    }
+
+    void image_writer::put(std::string& out, uint8_t value)
+    {
+        out.push_back(static_cast<char>(value));
+    }
+
+    void image_writer::put(std::string& out, uint32_t value)
+    {
+        out.push_back(static_cast<char>(value & 0xff));
+        out.push_back(static_cast<char>((value >> 8) & 0xff));
+        out.push_back(static_cast<char>((value >> 16) & 0xff));
+        out.push_back(static_cast<char>((value >> 24) & 0xff));
+    }
+
+    void image_writer::put(std::string& out, const std::string& value)
+    {
+        put(out, static_cast<uint32_t>(value.size()));
+        out.append(value);
+    }
+}
@@ -1,256 +1,429 @@
 #include "slist_log.h"
-#include <iostream>
+
+#include <unordered_map>
+#include <vector>
 
 namespace
 {
-    slist::log_level global_log_level = slist::log_level::warning;
-    bool global_log_from_print = false;
+    thread_local slist::log_settings thread_settings;
+    thread_local slist::log_settings *active_settings = nullptr;
+
+    slist::log_settings& settings();
+
+    void append_env(std::string& out, const slist::environment_ptr& env);
+
+    enum class print_step
+    {
+        value,    // A whole value
+        contents, // A list without its parentheses
+        rest,     // What follows the car of a list: nothing, " x ..." or " . x"
+        text,     // A fixed text
+    };
 
-    void log(const std::string& str, slist::log_level level, bool in_pair = false);
-    void log(const slist::node_ptr& n, slist::log_level level, bool in_pair = false);
-    void log(const slist::procedure_ptr& f, slist::log_level level, bool in_pair = false);
-    void log_internal(const std::string& str, slist::log_level level);
+    struct print_item
+    {
+        print_item(print_step step, const slist::node *n, const char *text = nullptr)
+            : step(step), n(n), text(text) {}
+
+        print_step step;
+        const slist::node *n;
+        const char *text;
+    };
+
+    bool is_quote(const slist::node *p);
+    void find_cycles(const slist::node_ptr& root, std::unordered_map<const slist::node *, long>& labels);
 }
 
 namespace slist
 {
+    log_settings::log_settings()
+        : level(log_level::warning)
+        , out(stdout_sink())
+        , err(stderr_sink())
+    {
+    }
+
+    log_scope::log_scope(log_settings& settings)
+        : prev(active_settings)
+    {
+        active_settings = &settings;
+    }
+
+    log_scope::~log_scope()
+    {
+        active_settings = prev;
+    }
+
     log_level get_log_level()
     {
-        return global_log_level;
+        return settings().level;
     }
 
     void set_log_level(log_level level)
     {
-        global_log_level = level;
+        settings().level = level;
+    }
+
+    void flush_output()
+    {
+        settings().out->flush();
     }
 
     void output(const std::string& str, node_ptr n, procedure_ptr f, bool from_print)
     {
-        global_log_from_print = from_print;
-        log(str, log_level::always);
-        log(n, log_level::always);
-        log(f, log_level::always);
-        global_log_from_print = false;
+        std::string text(str);
+        write_node(text, n, from_print);
+        log_append(text, f);
+        write_log(log_level::always, text);
     }
 
     void outputln(const std::string& str, node_ptr n, procedure_ptr f, bool from_print)
     {
-        output(str, n, f, from_print);
-        log("\n", log_level::always);
+        std::string text(str);
+        write_node(text, n, from_print);
+        log_append(text, f);
+        text += '\n';
+        write_log(log_level::always, text);
     }
 
-    void log_warning(const std::string& str, node_ptr n, procedure_ptr f)
+    bool is_log_enabled(log_level level)
     {
-        log(str, log_level::warning);
-        log(n, log_level::warning);
-        log(f, log_level::warning);
-    }   
+        return level <= settings().level;
+    }
 
-    void log_warningln(const std::string& str, node_ptr n, procedure_ptr f)
+    void write_log(log_level level, const std::string& text)
     {
-        log_warning(str, n, f);
-        log("\n", log_level::warning);
+        log_settings& s = settings();
+        if (level == log_level::always || level == log_level::trace)
+        {
+            s.out->write(text.data(), text.size());
+        }
+        else 
+        {
+            // Errors come after the output that led to them
+            if (s.out != s.err)
+            {
+                s.out->flush();
+            }
+            s.err->write(text.data(), text.size());
+        }
     }
 
-    void log_error(const std::string& str, node_ptr n, procedure_ptr f)
+    void log_append(std::string& out, const std::string& str)
     {
-        log(str, log_level::error);
-        log(n, log_level::error);
-        log(f, log_level::error);
+        out += str;
     }
 
-    void log_errorln(const std::string& str, node_ptr n, procedure_ptr f)
+    void log_append(std::string& out, const char *str)
     {
-        log_error(str, n, f);
-        log("\n", log_level::error);
+        if (str != nullptr)
+        {
+            out += str;
+        }
     }
 
-    void log_trace_slow(const std::string& str, node_ptr n, procedure_ptr f)
+    void log_append(std::string& out, std::nullptr_t)
     {
-        log(str, log_level::trace);
-        log(n, log_level::trace);
-        log(f, log_level::trace);
     }
 
-    void log_traceln_slow(const std::string& str, node_ptr n, procedure_ptr f)
+    void log_append(std::string& out, const node_ptr& n)
     {
-        log_trace_slow(str, n, f);
-        log("\n", log_level::trace);
+        write_node(out, n, false);
     }
-}
 
-namespace
-{
-    void log(const std::string& str, slist::log_level level, bool in_pair)
+    void log_append(std::string& out, const procedure_ptr& f)
     {
-        if (level > global_log_level)
+        if (f == nullptr)
         {
             return;
         }
 
-        log_internal(str, level);
+        out += "Func: ";
+        out += f->name;
+        out += '\n';
+
+        out += "Vars: ";
+        for (node_ptr var = f->variables; var != nullptr; var = var->cdr)
+        {
+            if (var->car != nullptr)
+            {
+                out += var->car->value;
+                out += ' ';
+            }
+            else
+            {
+                out += "nil";
+            }
+        }
+        out += '\n';
+
+        out += "Body: ";
+        write_node(out, f->body, false);
+        out += '\n';
+
+        out += "Env:  ";
+        append_env(out, f->env);
     }
 
-    void log(const slist::node_ptr& n, slist::log_level level, bool in_pair)
+    void write_node(std::string& out, const node_ptr& n, bool from_print)
     {
-        using namespace slist;
-
-        if (level > global_log_level || n == nullptr)
+        if (n == nullptr)
         {
             return;
         }
 
-        if (n == nullptr)
+        // Pairs seen again while they are being printed get a label
+        std::unordered_map<const node *, long> labels;
+        find_cycles(n, labels);
+        long next_label = 0;
+
+        std::vector<print_item> pending(1, print_item(print_step::value, n.get()));
+        while (!pending.empty())
         {
-            if (global_log_level >= log_level::trace)
+            print_item item = pending.back();
+            pending.pop_back();
+
+            const node *p = item.n;
+            switch (item.step)
+            {
+                case print_step::text:
+                    out += item.text;
+                    continue;
+
+                case print_step::rest:
+                    // What follows the car of a list
+                    if (p == nullptr)
+                    {
+                        continue;
+                    }
+                    if (p->type == node_type::pair && labels.find(p) == labels.end())
+                    {
+                        out += ' ';
+                        pending.push_back(print_item(print_step::contents, p));
+                    }
+                    else
+                    {
+                        out += " . ";
+                        pending.push_back(print_item(print_step::value, p));
+                    }
+                    continue;
+
+                case print_step::contents:
+                    // A list without its parentheses
+                    if (p == nullptr)
+                    {
+                        continue;
+                    }
+                    if (p->type != node_type::pair || labels.find(p) != labels.end())
+                    {
+                        pending.push_back(print_item(print_step::value, p));
+                    }
+                    else if (is_quote(p))
+                    {
+                        out += '\'';
+                        pending.push_back(print_item(print_step::contents, p->cdr.get()));
+                    }
+                    else
+                    {
+                        pending.push_back(print_item(print_step::rest, p->cdr.get()));
+                        pending.push_back(print_item(print_step::value, p->car.get()));
+                    }
+                    continue;
+
+                case print_step::value:
+                    break;
+            }
+
+            if (p == nullptr)
             {
-                log_internal("nil\n", level);
+                continue;
             }
-            return;
-        }
 
-        switch (n->type)
-        {
-            case slist::node_type::pair:
-                if (n->car != nullptr && 
-                    n->car->type == node_type::name && 
-                    n->car->value == "'")
-                {
-                    // Quote, skip the list format
-                    log(n->car, level, false);
-                    log(n->cdr, level, true);
-                }
-                else 
-                {
-                    if (!in_pair)
+            switch (p->type)
+            {
+                case node_type::pair:
                     {
-                        log_internal("(", level);
-                        if (n->is_tail)
+                        auto label = labels.find(p);
+                        if (label != labels.end())
                         {
-                            log_internal("<T> ", level);
+                            if (label->second >= 0)
+                            {
+                                out += '#' + std::to_string(label->second) + '#';
+                                break;
+                            }
+                            label->second = next_label++;
+                            out += '#' + std::to_string(label->second) + '=';
                         }
-                    }
-                    log(n->car, level, false);
-                    if (n->cdr != nullptr)
-                    {
-                        if (n->cdr->type == slist::node_type::pair)
+
+                        if (is_quote(p))
                         {
-                            log_internal(" ", level);
-                            log(n->cdr, level, true);
+                            // Quote, skip the list format
+                            out += '\'';
+                            pending.push_back(print_item(print_step::contents, p->cdr.get()));
                         }
                         else
                         {
-                            log_internal(" . ", level);
-                            log(n->cdr, level, true);
-                        }   
-                    } 
-                    if (!in_pair)
-                    {
-                        log_internal(")", level);
-                    }                   
-                }
-                break;
-            case node_type::string:
-                {
-                    if (global_log_from_print)
+                            out += '(';
+                            pending.push_back(print_item(print_step::text, nullptr, ")"));
+                            pending.push_back(print_item(print_step::rest, p->cdr.get()));
+                            pending.push_back(print_item(print_step::value, p->car.get()));
+                        }
+                    }
+                    break;
+
+                case node_type::string:
+                    if (from_print)
                     {
-                        log_internal(n->value, level);
+                        out += p->value;
                     }
                     else
                     {
-                        log_internal("\"" + n->value + "\"", level);                        
+                        // Escaped the way the parser reads them back
+                        out += '"';
+                        for (char ch : p->value)
+                        {
+                            if (ch == '"' || ch == '\\')
+                            {
+                                out += '\\';
+                            }
+                            out += ch;
+                        }
+                        out += '"';
                     }
-                }
-                break;
-            default:
-                if (n->proc != nullptr)
-                {
-                    log_internal("procedure: " + n->proc->name, level);
-                    if (n->proc->body != nullptr)
+                    break;
+
+                case node_type::promise:
                     {
-                        log_internal(" ", level);
-                        log(n->proc->body, level);
+                        std::lock_guard<std::mutex> lock(p->promise->lock);
+                        out += p->promise->is_forced ? "<promise: forced>" : "<promise>";
                     }
-                }
-                else 
-                {
-                    log_internal(n->value, level);              
-                }
-                break;
+                    break;
+
+                default:
+                    if (p->proc != nullptr)
+                    {
+                        out += "procedure: ";
+                        out += p->proc->name;
+                        if (p->proc->body != nullptr)
+                        {
+                            out += ' ';
+                            pending.push_back(print_item(print_step::value, p->proc->body.get()));
+                        }
+                    }
+                    else
+                    {
+                        out += p->value;
+                    }
+                    break;
+            }
         }
     }
 
-    void log_env(const slist::environment_ptr& env, slist::log_level level)
+    std::string to_string(const node_ptr& n, bool from_print)
     {
-        if (env == nullptr || env->is_global)
-        {
-            return;
-        }
-        log_internal("[", level);
-        for (auto& keyval : env->bindings)
+        std::string out;
+        write_node(out, n, from_print);
+        return out;
+    }
+}
+
+namespace
+{
+    slist::log_settings& settings()
+    {
+        return (active_settings != nullptr) ? *active_settings : thread_settings;
+    }
+
+    void append_env(std::string& out, const slist::environment_ptr& env)
+    {
+        // Innermost first, up to the global environment
+        for (const slist::environment *e = env.get(); e != nullptr && !e->is_global; e = e->parent.get())
         {
-            log_internal("\"" + keyval.first + "\": ", level);
-            if (keyval.second != nullptr && keyval.second->car == nullptr && keyval.second->proc != nullptr && keyval.second->proc->is_native)
+            out += '[';
+            for (auto& keyval : e->bindings)
             {
-                log_internal("<native func>", level);
-            }
-            else 
-            {
-                log(keyval.second, level);
+                out += '"';
+                out += keyval.first;
+                out += "\": ";
+                if (keyval.second != nullptr && keyval.second->car == nullptr && keyval.second->proc != nullptr && keyval.second->proc->is_native)
+                {
+                    out += "<native func>";
+                }
+                else 
+                {
+                    slist::write_node(out, keyval.second, false);
+                }
             }
+            out += "] ";
         }
-        log_internal("] ", level);
-        log_env(env->parent, level);
     }
 
-    void log(const slist::procedure_ptr& f, slist::log_level level, bool in_pair)
+    bool is_quote(const slist::node *p)
     {
         using namespace slist;
+        return p->car != nullptr &&
+               p->car->type == node_type::name &&
+               p->car->value == "'";
+    }
 
-        if (level > global_log_level || f == nullptr)
-        {
-            return;
-        }
+    // Depth-first search labelling the pairs reached again while they are
+    // being visited, with -1 until they are printed.  Only pairs referred to
+    // more than once can be, so the others are not tracked.
+    void find_cycles(const slist::node_ptr& root, std::unordered_map<const slist::node *, long>& labels)
+    {
+        using namespace slist;
 
-        log_internal("Func: ", level);
-        log_internal(f->name+"\n", level);
+        // Shared pairs being visited, and those done
+        std::unordered_map<const node *, bool> is_active;
 
-        log_internal("Vars: ", level);
-        node_ptr var = f->variables;
-        while (var != nullptr)
+        // A null entry marks the end of the shared pair below it
+        std::vector<const node_ptr *> pending(1, &root);
+        while (!pending.empty())
         {
-            if (var->car != nullptr)
+            const node_ptr *n = pending.back();
+            pending.pop_back();
+
+            if (n == nullptr)
             {
-                log_internal(var->car->value + " ", level);
+                is_active[pending.back()->get()] = false;
+                pending.pop_back();
+                continue;
             }
-            else
+
+            const node *p = n->get();
+            if (p->type != node_type::pair)
             {
-                log_internal("nil", level);
+                if (p->proc != nullptr && p->proc->body != nullptr)
+                {
+                    pending.push_back(&p->proc->body);
+                }
+                continue;
             }
-            var = var->cdr;
-        }
-        log_internal("\n", level);
 
-        log_internal("Body: ", level);
-        log(f->body, level);
-        log_internal("\n", level);
-
-        log_internal("Env:  ", level);
-        log_env(f->env, level);
-    }
+            if (n->use_count() > 1)
+            {
+                auto it = is_active.find(p);
+                if (it != is_active.end())
+                {
+                    if (it->second)
+                    {
+                        labels.emplace(p, -1);
+                    }
+                    continue;
+                }
+                is_active.emplace(p, true);
+                pending.push_back(n);
+                pending.push_back(nullptr);
+            }
 
-    void log_internal(const std::string& str, slist::log_level level)
-    {
-        using namespace slist;
-        std::ostream *out = nullptr;
-        if (level == log_level::always || level == log_level::trace)
-        {
-            out = &std::cout;
-        }
-        else 
-        {
-            out = &std::cerr;
+            if (p->cdr != nullptr)
+            {
+                pending.push_back(&p->cdr);
+            }
+            if (p->car != nullptr)
+            {
+                pending.push_back(&p->car);
+            }
         }
-        *out << str << std::flush;
     }
-}
\ No newline at end of file
+}
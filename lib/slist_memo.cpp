@@ -0,0 +1,116 @@
+#include "slist_memo.h"
+#include "slist_native.h"
+
+namespace
+{
+    slist::node_ptr copy_key(const slist::node_ptr& n);
+}
+
+namespace slist
+{
+    memo_cache::memo_cache(const node_ptr& target, size_t capacity)
+        : target(target)
+        , capacity(capacity)
+        , hits(0)
+        , misses(0)
+    {
+    }
+
+    bool memo_cache::lookup(const node_ptr& args, node_ptr& value)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        auto it = index.find(args);
+        if (it == index.end())
+        {
+            ++misses;
+            return false;
+        }
+
+        ++hits;
+        entries.splice(entries.begin(), entries, it->second);
+        value = it->second->second;
+        return true;
+    }
+
+    void memo_cache::insert(const node_ptr& args, const node_ptr& value)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        auto it = index.find(args);
+        if (it != index.end())
+        {
+            // A recursive call computed it first
+            it->second->second = value;
+            entries.splice(entries.begin(), entries, it->second);
+            return;
+        }
+
+        node_ptr key = copy_key(args);
+        entries.emplace_front(key, value);
+        index[key] = entries.begin();
+
+        if (capacity > 0 && entries.size() > capacity)
+        {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    size_t memo_cache::size() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return entries.size();
+    }
+
+    size_t memo_cache::key_hash::operator()(const node_ptr& n) const
+    {
+        return native_hash_helper(n);
+    }
+
+    bool memo_cache::key_equal::operator()(const node_ptr& n1, const node_ptr& n2) const
+    {
+        return native_equal_helper(n1, n2);
+    }
+}
+
+namespace
+{
+    // Copy of the pairs of 'n', sharing the atoms: 'append!' and 'reverse!'
+    // on the arguments must not change a stored key
+    slist::node_ptr copy_key(const slist::node_ptr& n)
+    {
+        using namespace slist;
+
+        // Iterate on the cdr, recurse on the car only
+        node_ptr head;
+        node *tail = nullptr;
+        for (node_ptr p = n; p != nullptr; p = p->cdr)
+        {
+            node_ptr copy = p;
+            if (p->type == node_type::pair)
+            {
+                copy = std::make_shared<node>();
+                copy->type = node_type::pair;
+                copy->car = copy_key(p->car);
+            }
+
+            if (tail != nullptr)
+            {
+                tail->cdr = copy;
+            }
+            else
+            {
+                head = copy;
+            }
+
+            if (p->type != node_type::pair)
+            {
+                break;
+            }
+            tail = copy.get();
+        }
+
+        return head;
+    }
+}
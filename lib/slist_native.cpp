@@ -2,48 +2,16 @@
 #include "slist_context.h"
 #include "slist_eval.h"
 #include "slist_log.h"
+#include "slist_memo.h"
+#include "slist_parallel.h"
+#include "slist_serialize.h"
 
 #include <algorithm>
+#include <cmath>
 #include <stdexcept>
 
 namespace slist
 {
-    node_ptr native_eval(context& ctx, const node_ptr& root)
-    {
-        if (root->length() != 2)
-        {
-            log_errorln("'eval' expects one argument: ", root);
-            return nullptr;
-        }
-
-        return eval(ctx, eval(ctx, root->get(1)));
-    }
-
-    node_ptr native_apply(context& ctx, const node_ptr& root)
-    {
-        if (root->length() < 3)
-        {
-            log_errorln("Not enough arguments for 'apply'\n", root);
-            return nullptr;
-        }
-
-        node_ptr func_node = eval(ctx, root->get(1));
-        if (func_node->proc == nullptr)
-        {
-            log_errorln("First argument for 'apply' is not a procedure:\n", func_node);
-            return nullptr;
-        }
-
-        node_ptr args = eval(ctx, root->get(2));
-        if (args->type != node_type::pair)
-        {
-            log_errorln("Arguments is not a list:\n", args);
-            return nullptr;
-        }
-
-        return apply(ctx, args, func_node);
-    }
-
     node_ptr native_cons(context& ctx, const node_ptr& root)
     {
         if (root->length() != 3)
@@ -54,8 +22,8 @@ namespace slist
 
         node_ptr result(std::make_shared<node>());
         result->type = node_type::pair;
-        result->car = eval(ctx, root->get(1));
-        result->cdr = eval(ctx, root->get(2));
+        result->car = root->get(1);
+        result->cdr = root->get(2);
 
         return result;
     }
@@ -73,7 +41,7 @@ namespace slist
             return nullptr;
         }
 
-        node_ptr n = eval(ctx, root->get(1));
+        node_ptr n = root->get(1);
         if (n != nullptr && n->type == node_type::pair)
         {
             return n->car;
@@ -90,7 +58,7 @@ namespace slist
             return nullptr;
         }
 
-        node_ptr n = eval(ctx, root->get(1));
+        node_ptr n = root->get(1);
         if (n != nullptr && n->type == node_type::pair && n->cdr != nullptr)
         {
             return n->cdr;
@@ -102,88 +70,6 @@ namespace slist
         return empty;
     }
 
-    node_ptr native_quote_arg(context& ctx, node_ptr arg)
-    {
-        node_ptr result;
-        if (arg->type == node_type::name)
-        {
-            auto symb = ctx.lookup_symbol(arg->value);
-            if (symb != nullptr)
-            {
-                result = symb;
-            }
-            else 
-            {
-                ctx.insert_symbol(arg);
-                result = arg;
-            }
-        }
-        else if (arg->type == node_type::integer || 
-                 arg->type == node_type::number  ||
-                 arg->type == node_type::string)
-        {
-            return arg;
-        }
-        else if (arg->type == node_type::pair)
-        {
-            if (arg->length() == 2)
-            {
-                // Check if it's an 'unquote'
-                node_ptr subarg = arg->get(0);
-                if (subarg->type == node_type::name &&
-                    (subarg->value == "unquote"))
-                {
-                    return eval(ctx, arg->get(1));
-                }
-            }
-
-            result = std::make_shared<node>();
-            result->type = node_type::pair;
-
-            while (arg != nullptr)
-            {
-                if (arg->car == nullptr)
-                {
-                    arg = arg->cdr;
-                    continue;
-                }
-
-                node_ptr n = native_quote_arg(ctx, arg->car);
-                if (n != nullptr)
-                {
-                    result->append(n);
-                }
-                else 
-                {
-                    log_errorln("Cannot quote: ", arg->car);
-                    return nullptr;
-                }
-                
-                arg = arg->cdr;
-            }
-        }
-        else 
-        {
-            log_errorln("Invalid argument to quote: ", arg);
-            return nullptr;
-        }
-        
-        return result;
-    }
-
-    node_ptr native_quote(context& ctx, const node_ptr& root)
-    {
-        if (root->length() != 2)
-        {
-            log_errorln("'quote' expects one argument:\n", root);
-            return nullptr;
-        }
-
-        node_ptr arg = root->get(1);
-
-        return native_quote_arg(ctx, arg);
-    }
-
     node_ptr native_unquote(context& ctx, const node_ptr& root)
     {
         if (root->length() != 2)
@@ -195,391 +81,208 @@ namespace slist
         return root->get(1);
     }
 
-    node_ptr native_lambda(context& ctx, const node_ptr& root)
+    node_ptr native_length(context& ctx, const node_ptr& root)
     {
-        if (root->proc != nullptr)
-        {
-            log_warningln("Evaluating a lambda that already has a procedure. Was it evaluated twice?");
-            return root;
-        }
-
-        if (root->length() != 3)
+        if (root->length() != 2)
         {
-            log_errorln("Invalid lambda format\n", root);
+            log_errorln("Invalid 'length' statement");
             return nullptr;
         }
 
-        procedure_ptr func(std::make_shared<procedure>());
-        func->env->parent = ctx.active_env;
-        func->is_native = false;
-        func->name = root->get(0)->value; // "lambda"
-        func->variables = root->get(1);
-        func->body = root->get(2);
-
-        node_ptr res(std::make_shared<node>());
-        res->proc = func;
-        res->set_as_tail();
+        auto arg = root->get(1);
 
-        // LOG_TRACELN("Lambda proc:\n", nullptr, func);
+        node_ptr result(std::make_shared<node>());
+        result->set_int(arg != nullptr ? arg->length() : 0);
 
-        return res;        
+        return result;
     }
 
-    node_ptr make_define(context& ctx, const node_ptr& root, bool is_macro)
+    node_ptr native_empty(context& ctx, const node_ptr& root)
     {
-        if (root->length() < 3)
+        if (root->length() != 2)
         {
-            log_errorln("Invalid arguments for 'define'\n", root);
+            log_errorln("Invalid 'empty?' statement");
             return nullptr;
         }
 
-        node_ptr first = root->get(1);
-        node_ptr body = root->get(2);
-
-        if (first->type == node_type::pair)
-        {
-            // Lambda syntactic sugar
-            // (define (f x) (...)) -> (define f (lambda (x) (...))
-
-            node_ptr name = first->car;
-            node_ptr args = first->cdr;
-
-            node_ptr lambda_node(std::make_shared<node>());
-            lambda_node->type = node_type::pair;
-
-            node_ptr name_node(std::make_shared<node>());
-            name_node->value = "lambda";
-            name_node->type = node_type::name;          
-            lambda_node->append(name_node);
-            lambda_node->append(args);
-            lambda_node->append(body);
-
-            // LOG_TRACELN("Lambda from scratch:\n", lambda_node);
-
-            node_ptr lambda = native_lambda(ctx, lambda_node);
-
-            if (lambda != nullptr && lambda->proc != nullptr)
-            {
-                lambda->proc->is_macro = is_macro;
-            }
+        auto arg = root->get(1);
 
-            ctx.active_env->register_variable(name->value, lambda);
-        }
-        else if (first->type == node_type::name)
-        {
-            node_ptr res = eval(ctx, body);
-            ctx.active_env->register_variable(first->value, res);            
-        }
+        // TODO: I need a more 'standard' way to define an empty node
+        bool is_empty = (arg == nullptr)                ||
+                        (arg->car == nullptr)           ||
+                        (arg->type == node_type::empty) ||
+                        (arg->length() == 0);
 
-        return nullptr;
-    }
+        node_ptr result(std::make_shared<node>());
+        result->set_bool(is_empty);
 
-    node_ptr native_define(context& ctx, const node_ptr& root)
-    {
-        return make_define(ctx, root, false);
+        return result;
     }
 
-    node_ptr native_defmacro(context& ctx, const node_ptr& root)
+    // '() is a pair without car nor cdr, and (list) is nullptr
+    bool list_is_empty(const node_ptr& list)
     {
-        return make_define(ctx, root, true);
+        return list == nullptr || (list->car == nullptr && list->cdr == nullptr);
     }
 
-    node_ptr native_set(context& ctx, const node_ptr& root)
+    node_ptr native_reverse_inplace(context& ctx, const node_ptr& root)
     {
-        if (root->length() != 3)
+        node_ptr list = root->get(1);
+        if (root->length() != 2 || (list != nullptr && list->type != node_type::pair))
         {
-            log_errorln("Invalid 'set!' syntax: ", root);
+            log_errorln("'reverse!' expects a list: ", root);
             return nullptr;
         }
 
-        node_ptr name = root->get(1);
-        node_ptr arg = eval(ctx, root->get(2));
-
-        if (!ctx.active_env->set_variable(name->value, arg))
+        if (list_is_empty(list))
         {
-            log_errorln("Cannot set unbound variable: ", name);
-            return nullptr;
+            return list_builder().head;
         }
 
-        return nullptr;
-    }
-
-    node_ptr native_let(context& ctx, const node_ptr& root)
-    {
-        // Let is syntactic sugar:
-        //    (lambda (x)
-        //        (let ((y 2)) (+ x y))) 
-        // <-->
-        //    (lambda (x)
-        //        ((lambda (y) (+ x y)) 2))
-
-        if (root->length() != 3)
+        if (list->is_constant)
         {
-            log_errorln("Invalid 'let' syntax: ", root);
+            log_errorln("'reverse!' cannot modify a quoted list, copy it first: ", root);
             return nullptr;
         }
 
-        environment_ptr env(std::make_shared<environment>());
-        env->parent = ctx.active_env;
-
-        node_ptr bindings = root->get(1);
-        if (bindings == nullptr || bindings->type != node_type::pair)
+        // Relinks the cells: the first one becomes the last
+        node_ptr reversed;
+        node_ptr n = list;
+        while (n != nullptr)
         {
-            log_errorln("Invalid bindings for 'let': ", root);
-            return nullptr;
+            node_ptr next = std::move(n->cdr);
+            n->cdr = std::move(reversed);
+            reversed = std::move(n);
+            n = std::move(next);
         }
+        return reversed;
+    }
 
-        node_ptr binding = bindings;
-        while (binding != nullptr)
+    node_ptr native_append_inplace(context& ctx, const node_ptr& root)
+    {
+        // The lists and their last cells are all found before any is
+        // modified, so that an error leaves the arguments intact
+        std::vector<node_ptr> lists;
+        std::vector<node *> tails;
+        for (node *arg = root->cdr.get(); arg != nullptr; arg = arg->cdr.get())
         {
-            node_ptr name_value = binding->car;
-            if (name_value == nullptr || name_value->length() != 2)
+            const node_ptr& list = arg->car;
+            if (list != nullptr && list->type != node_type::pair)
             {
-                log_errorln("Invalid 'let' binding: ", binding);
+                log_errorln("'append!' expects lists: ", root);
                 return nullptr;
             }
 
-            node_ptr var_name = name_value->get(0);
-            if (var_name->type != node_type::name)
+            if (list_is_empty(list))
             {
-                log_errorln("Invalid variable name in binding: ", name_value);
-                return nullptr;
+                continue;
             }
 
-            node_ptr value = eval(ctx, name_value->get(1));
-            env->register_variable(var_name->value, value);
-
-            binding = binding->cdr;
-        }
-
-        auto old_active_env = ctx.active_env;
-        ctx.active_env = env;
-
-        procedure_ptr func(std::make_shared<procedure>());
-        func->is_native = false;
-        func->name = root->get(0)->value; // "let"
-        func->env = env;
-        func->body = root->get(2);
-
-        ctx.active_env = old_active_env;
-
-        node_ptr res(std::make_shared<node>());
-        res->proc = func;
-
-        // LOG_TRACELN("'let' proc:\n", nullptr, func);
-
-        return eval_procedure(ctx, res, nullptr);
-    }
-
-    node_ptr native_letrec(context& ctx, const node_ptr& root)
-    {
-        // Example:
-        //    (lambda (x)
-        //        (letrec ((y 2)) (+ x y))) 
-
-        // Letrec is equivalent to:
-        //    (lambda (x)
-        //        ((lambda (y)
-        //            (begin
-        //                (set! y 2) ; <-- argument is transfered here
-        //                           ;     and becomes part of closure's environment
-        //                (+ x y))) '()))
-
-        if (root->length() != 3)
-        {
-            log_errorln("Invalid 'letrec' syntax: ", root);
-            return nullptr;
+            node *tail = list.get();
+            while (tail->cdr != nullptr)
+            {
+                tail = tail->cdr.get();
+            }
+            lists.push_back(list);
+            tails.push_back(tail);
         }
 
-        environment_ptr env(std::make_shared<environment>());
-        env->parent = ctx.active_env;
-
-        node_ptr bindings = root->get(1);
-        if (bindings == nullptr || bindings->type != node_type::pair)
+        if (lists.empty())
         {
-            log_errorln("Invalid bindings for 'letrec': ", root);
-            return nullptr;
+            return list_builder().head;
         }
 
-        // Build a (begin) node to store the values
-        node_ptr begin_node(std::make_shared<node>());
-        begin_node->type = node_type::pair;
-
-        node_ptr begin_name(std::make_shared<node>());
-        begin_name->set_name("begin");
-        begin_node->append(begin_name);
-
-        node_ptr binding = bindings;
-        while (binding != nullptr)
+        // Links the last cell of each list to the next non-empty one
+        for (size_t i = 0; i + 1 < lists.size(); ++i)
         {
-            node_ptr name_value = binding->car;
-            if (name_value == nullptr || name_value->length() != 2)
-            {
-                log_errorln("Invalid 'let' binding: ", binding);
-                return nullptr;
-            }
-
-            node_ptr var_name = name_value->get(0);
-            if (var_name->type != node_type::name)
+            if (tails[i]->is_constant)
             {
-                log_errorln("Invalid variable name in binding: ", name_value);
+                log_errorln("'append!' cannot modify a quoted list, copy it first: ", root);
                 return nullptr;
             }
-
-            environment_ptr temp_env = ctx.active_env;
-            ctx.active_env = env;
-
-            node_ptr set_node(std::make_shared<node>());
-            set_node->type = node_type::pair;
-
-            node_ptr set_name(std::make_shared<node>());
-            set_name->set_name("set!");
-
-            set_node->append(set_name);
-            set_node->append(var_name);
-            set_node->append(eval(ctx, name_value->get(1)));
-
-            begin_node->append(set_node);
-
-            env->register_variable(var_name->to_name(), std::make_shared<node>());
-
-            ctx.active_env = temp_env;
-
-            binding = binding->cdr;
         }
-
-        begin_node->append(root->get(2));
-
-        auto old_active_env = ctx.active_env;
-        ctx.active_env = env;
-
-        procedure_ptr func(std::make_shared<procedure>());
-        func->is_native = false;
-        func->name = root->get(0)->value; // "let"
-        func->env = env;
-        func->body = begin_node;
-
-        ctx.active_env = old_active_env;
-
-        node_ptr res(std::make_shared<node>());
-        res->proc = func;
-
-        // LOG_TRACELN("'letrec' proc:\n", nullptr, func);
-
-        return eval_procedure(ctx, res, nullptr);
-    }
-
-    node_ptr native_begin(context& ctx, const node_ptr& root)
-    {
-        node_ptr n = root->cdr;
-
-        node_ptr result;
-        bool stop = false;
-        while (!stop)
+        for (size_t i = 0; i + 1 < lists.size(); ++i)
         {
-            if (n->cdr == nullptr)
-            {
-                if (root->is_tail)
-                {
-                    n->car->set_as_tail();
-                }
-                stop = true;
-            }
-            result = eval(ctx, n->car);
-            n = n->cdr;
+            tails[i]->cdr = lists[i + 1];
         }
 
-        return result;
+        return lists[0];
     }
 
-    node_ptr native_if(context& ctx, const node_ptr& root)
+    node_ptr native_list_copy(context& ctx, const node_ptr& root)
     {
-        if (root->length() != 4)
+        node_ptr list = root->get(1);
+        if (root->length() != 2 || (list != nullptr && list->type != node_type::pair))
         {
-            log_errorln("Invalid 'if' statement");
+            log_errorln("'list-copy' expects a list: ", root);
             return nullptr;
         }
 
-        auto true_node = root->get(2);
-        auto false_node = root->get(3);
-
-        if (root->is_tail)
+        list_builder result;
+        if (!list_is_empty(list))
         {
-            true_node->set_as_tail();
-            false_node->set_as_tail();
+            for (node *n = list.get(); n != nullptr; n = n->cdr.get())
+            {
+                result.append(n->car);
+            }
         }
+        return result.head;
+    }
 
-        auto pred = eval(ctx, root->get(1));
-        if (pred == nullptr || pred->type != node_type::boolean)
+    node_ptr native_print(context& ctx, const node_ptr& root)
+    {
+        if (root->length() > 1)
         {
-            log_errorln("Predicate did not evaluate to a boolean value");
-            return nullptr;
+            output("", root->cdr->car, nullptr, true);
         }
+        return nullptr;
+    }
 
-        if (pred->to_bool())
+    node_ptr native_println(context& ctx, const node_ptr& root)
+    {
+        if (root->length() > 1)
         {
-            return eval(ctx, true_node);
+            outputln("", root->cdr->car, nullptr, true);
         }
+        return nullptr;
+    }
 
-        return eval(ctx, false_node);
+    node_ptr native_flush(context& ctx, const node_ptr& root)
+    {
+        ctx.log.out->flush();
+        return nullptr;
     }
 
-    node_ptr native_length(context& ctx, const node_ptr& root)
+    node_ptr native_to_string(context& ctx, const node_ptr& root)
     {
         if (root->length() != 2)
         {
-            log_errorln("Invalid 'length' statement");
+            log_errorln("'to-string' expects one argument: ", root);
             return nullptr;
         }
 
-        auto arg = eval(ctx, root->get(1));
-
+        // As printed by 'print'
         node_ptr result(std::make_shared<node>());
-        result->set_int(arg->length());
-
+        result->type = node_type::string;
+        write_node(result->value, root->get(1), true);
         return result;
     }
 
-    node_ptr native_empty(context& ctx, const node_ptr& root)
+    node_ptr native_write_string(context& ctx, const node_ptr& root)
     {
         if (root->length() != 2)
         {
-            log_errorln("Invalid 'empty?' statement");
+            log_errorln("'write-string' expects one argument: ", root);
             return nullptr;
         }
 
-        auto arg = eval(ctx, root->get(1));
-
-        // TODO: I need a more 'standard' way to define an empty node
-        bool is_empty = (arg == nullptr)                ||
-                        (arg->car == nullptr)           ||
-                        (arg->type == node_type::empty) ||
-                        (arg->length() == 0);
-
+        // As printed for results, strings within quotes
         node_ptr result(std::make_shared<node>());
-        result->set_bool(is_empty);
-
+        result->type = node_type::string;
+        write_node(result->value, root->get(1), false);
         return result;
     }
 
-    node_ptr native_print(context& ctx, const node_ptr& root)
-    {
-        if (root->length() > 1)
-        {
-            output("", eval(ctx, root->cdr->car), nullptr, true);
-        }
-        return nullptr;
-    }
-
-    node_ptr native_println(context& ctx, const node_ptr& root)
-    {
-        if (root->length() > 1)
-        {
-            outputln("", eval(ctx, root->cdr->car), nullptr, true);
-        }
-        return nullptr;
-    }
-
     node_ptr native_eq(context& ctx, const node_ptr& root)
     {
         if (root->length() != 3)
@@ -588,11 +291,11 @@ namespace slist
             return nullptr;
         }
 
-        node_ptr v1 = eval(ctx, root->get(1));
-        node_ptr v2 = eval(ctx, root->get(2));
+        node_ptr v1 = root->get(1);
+        node_ptr v2 = root->get(2);
 
-        bool value = false;
-        if (v1->type == v2->type)
+        bool value = (v1 == v2);
+        if (v1 != nullptr && v2 != nullptr && v1->type == v2->type)
         {
             if (v1->type == node_type::integer || v1->type == node_type::number)
             {
@@ -610,35 +313,77 @@ namespace slist
         return result;
     }
 
-    bool native_equal_helper(context& ctx, const node_ptr& arg1, const node_ptr& arg2)
+    bool native_equal_helper(node_ptr arg1, node_ptr arg2)
     {
-        if (arg1 == nullptr && arg2 == nullptr)
+        // Iterate on the cdr, recurse on the car only
+        while (arg1 != nullptr && arg2 != nullptr)
         {
-            return true;
-        }
-        else if (arg1 == nullptr || arg2 == nullptr)
-        {
-            return false;
+            if (arg1 == arg2)
+            {
+                return true;
+            }
+
+            if (arg1->type != arg2->type)
+            {
+                return false;
+            }
+
+            switch (arg1->type)
+            {
+                case node_type::boolean:
+                case node_type::integer:
+                case node_type::number:
+                case node_type::string:
+                case node_type::name:
+                    return arg1->value == arg2->value;
+                case node_type::pair:
+                    if (!native_equal_helper(arg1->car, arg2->car))
+                    {
+                        return false;
+                    }
+                    arg1 = arg1->cdr;
+                    arg2 = arg2->cdr;
+                    break;
+                default:
+                    // Procedures and promises are only equal to themselves
+                    return false;
+            }
         }
-        else 
+
+        return arg1 == arg2;
+    }
+
+    size_t native_hash_helper(node_ptr n)
+    {
+        // Consistent with 'native_equal_helper': equal nodes hash the same
+        size_t result = 0;
+        std::hash<std::string> hash_string;
+
+        while (n != nullptr)
         {
-            bool result = false;
-            if (arg1->type == arg2->type)
+            size_t h = static_cast<size_t>(n->type);
+            switch (n->type)
             {
-                if (arg1->type == node_type::integer || 
-                    arg1->type == node_type::number  ||
-                    arg1->type == node_type::string)
-                {
-                    result = (arg1->value == arg2->value);
-                }
-                else if (arg1->type == node_type::pair)
-                {
-                    result = native_equal_helper(ctx, arg1->car, arg2->car) &&
-                             native_equal_helper(ctx, arg1->cdr, arg2->cdr);
-                }
+                case node_type::boolean:
+                case node_type::integer:
+                case node_type::number:
+                case node_type::string:
+                case node_type::name:
+                    h ^= hash_string(n->value);
+                    break;
+                case node_type::pair:
+                    h ^= native_hash_helper(n->car);
+                    break;
+                default:
+                    h ^= std::hash<node*>()(n.get());
+                    break;
             }
-            return result;
+
+            result = result * 31 + h;
+            n = (n->type == node_type::pair) ? n->cdr : nullptr;
         }
+
+        return result;
     }
 
     node_ptr native_equal(context& ctx, const node_ptr& root)
@@ -649,10 +394,10 @@ namespace slist
             return nullptr;
         }
 
-        node_ptr arg1 = eval(ctx, root->get(1));
-        node_ptr arg2 = eval(ctx, root->get(2));
+        node_ptr arg1 = root->get(1);
+        node_ptr arg2 = root->get(2);
 
-        bool value = native_equal_helper(ctx, arg1, arg2);
+        bool value = native_equal_helper(arg1, arg2);
 
         node_ptr result(std::make_shared<node>());
         result->set_bool(value);
@@ -668,9 +413,9 @@ namespace slist
             return nullptr;
         }
 
-        node_ptr arg = eval(ctx, root->get(1));
+        node_ptr arg = root->get(1);
 
-        if (arg->type != node_type::boolean)
+        if (arg == nullptr || arg->type != node_type::boolean)
         {
             log_errorln("'not' argument did not evaluate to a boolean value: ", arg);
             return nullptr;
@@ -691,10 +436,10 @@ namespace slist
                 return nullptr; \
             } \
             \
-            node_ptr arg = eval(ctx, root->get(1)); \
+            node_ptr arg = root->get(1); \
             \
             node_ptr result(std::make_shared<node>()); \
-            result->set_bool(arg->type == node_type::TYPE); \
+            result->set_bool(arg != nullptr && arg->type == node_type::TYPE); \
             \
             return result; \
         }
@@ -704,6 +449,7 @@ namespace slist
     MAKE_PREDICATE_FUNC(native_is_int,     integer)
     MAKE_PREDICATE_FUNC(native_is_number,  number)
     MAKE_PREDICATE_FUNC(native_is_string,  string)
+    MAKE_PREDICATE_FUNC(native_is_promise, promise)
 
     node_ptr native_is_symbol(context& ctx, const node_ptr& root)
     {
@@ -713,12 +459,12 @@ namespace slist
             return nullptr;
         }
 
-        node_ptr arg = eval(ctx, root->get(1)); 
+        node_ptr arg = root->get(1); 
 
         bool is_symbol = false;
-        if (arg->type == node_type::name)
+        if (arg != nullptr && arg->type == node_type::name)
         {
-            if (ctx.symbols.find(arg->value) != ctx.symbols.end())
+            if (ctx.lookup_symbol(arg->value) != nullptr)
             {
                 is_symbol = true;
             }
@@ -793,7 +539,7 @@ namespace slist
             \
             node_ptr arg = root->cdr; \
             \
-            node_ptr result = eval(ctx, arg->car); \
+            node_ptr result = arg->car; \
             \
             if (!native_arithmetic_op_validate_arg(result)) \
             { \
@@ -803,7 +549,7 @@ namespace slist
             arg = arg->cdr; \
             while (arg != nullptr) \
             { \
-                result = native_arithmetic_op_helper(result, eval(ctx, arg->car), op); \
+                result = native_arithmetic_op_helper(result, arg->car, op); \
                 if (result == nullptr) \
                 { \
                     return nullptr; \
@@ -888,8 +634,8 @@ namespace slist
                 return nullptr; \
             } \
             \
-            node_ptr a1 = eval(ctx, root->get(1)); \
-            node_ptr a2 = eval(ctx, root->get(2)); \
+            node_ptr a1 = root->get(1); \
+            node_ptr a2 = root->get(2); \
             \
             if ((a1 == nullptr || (a1->type != node_type::integer && a1->type != node_type::number)) || \
                 (a2 == nullptr || (a2->type != node_type::integer && a2->type != node_type::number))) \
@@ -921,7 +667,7 @@ namespace slist
             return nullptr;
         }
 
-        node_ptr arg = eval(ctx, root->get(1));
+        node_ptr arg = root->get(1);
 
         if (arg == nullptr || arg->type != node_type::boolean)
         {
@@ -936,4 +682,406 @@ namespace slist
 
         return nullptr;
     }
-}
\ No newline at end of file
+
+    node_ptr native_make_promise(context& ctx, const node_ptr& root)
+    {
+        if (root->length() != 2)
+        {
+            log_errorln("'make-promise' expects one argument: ", root);
+            return nullptr;
+        }
+
+        node_ptr value = root->get(1);
+        if (value != nullptr && value->type == node_type::promise)
+        {
+            return value;
+        }
+
+        node_ptr result(std::make_shared<node>());
+        result->type = node_type::promise;
+        result->promise = std::make_shared<promise>();
+        result->promise->is_forced = true;
+        result->promise->value = value;
+
+        return result;
+    }
+
+    bool stream_is_empty(const node_ptr& s)
+    {
+        return s == nullptr ||
+               s->type != node_type::pair ||
+               (s->car == nullptr && s->cdr == nullptr);
+    }
+
+    node_ptr stream_make_cell(const node_ptr& value, const node_ptr& rest)
+    {
+        node_ptr cell(std::make_shared<node>());
+        cell->type = node_type::pair;
+        cell->car = value;
+        cell->cdr = rest;
+        return cell;
+    }
+
+    // Promise computed by a native: the delayed expression is a call to
+    // a native procedure wrapping 'thunk'
+    node_ptr stream_make_lazy(context& ctx, const std::function<node_ptr(context&)>& thunk)
+    {
+        procedure_ptr func(std::make_shared<procedure>());
+        func->name = "stream";
+        func->is_native = true;
+        func->is_strict = true;
+        func->native_func = [thunk](context& ctx, const node_ptr&) { return thunk(ctx); };
+
+        node_ptr func_node(std::make_shared<node>());
+        func_node->proc = func;
+
+        node_ptr result(std::make_shared<node>());
+        result->type = node_type::promise;
+        result->promise = std::make_shared<promise>();
+        result->promise->expr = stream_make_cell(func_node, nullptr);
+        result->promise->env = ctx.active_env;
+
+        return result;
+    }
+
+    node_ptr stream_call(context& ctx, const node_ptr& func, const node_ptr& arg)
+    {
+        return eval_procedure(ctx, func, stream_make_cell(arg, nullptr));
+    }
+
+    node_ptr stream_map_from(context& ctx, const node_ptr& func, const node_ptr& s)
+    {
+        if (stream_is_empty(s))
+        {
+            return s;
+        }
+
+        node_ptr rest = s->cdr;
+        return stream_make_cell(stream_call(ctx, func, s->car),
+                                stream_make_lazy(ctx, [func, rest](context& ctx)
+                                {
+                                    return stream_map_from(ctx, func, force(ctx, rest));
+                                }));
+    }
+
+    // Returns the argument 'index' of the call 'root' to a function, taken
+    // out of the arguments when nothing else refers to their list: a stream
+    // then stays alive only as long as the native walks it
+    node_ptr take_argument(const node_ptr& root, int index)
+    {
+        bool is_owned = true;
+        node *n = root.get();
+        for (int i = 0; i < index && n != nullptr; ++i)
+        {
+            is_owned = is_owned && n->cdr.use_count() == 1;
+            n = n->cdr.get();
+        }
+
+        if (n == nullptr)
+        {
+            return nullptr;
+        }
+        return is_owned ? std::move(n->car) : n->car;
+    }
+
+    // Scans 's' for the first item matching 'pred'.  Only the cell being
+    // tested is held: 'cursor', shared by the forcings of the promise of
+    // the rest, follows the scan instead of pinning where it started.
+    node_ptr stream_filter_from(context& ctx, const node_ptr& pred, node_ptr s,
+                                const std::shared_ptr<node_ptr>& cursor = nullptr)
+    {
+        while (!stream_is_empty(s))
+        {
+            node_ptr keep = stream_call(ctx, pred, s->car);
+            if (keep != nullptr && keep->type == node_type::boolean && keep->to_bool())
+            {
+                auto rest = std::make_shared<node_ptr>(s->cdr);
+                return stream_make_cell(s->car,
+                                        stream_make_lazy(ctx, [pred, rest](context& ctx)
+                                        {
+                                            // Not a temporary, which would last for the whole scan
+                                            node_ptr s = force(ctx, std::atomic_load(rest.get()));
+                                            return stream_filter_from(ctx, pred, std::move(s), rest);
+                                        }));
+            }
+
+            s = force(ctx, s->cdr);
+            if (cursor != nullptr)
+            {
+                std::atomic_store(cursor.get(), s);
+            }
+        }
+
+        return s;
+    }
+
+    node_ptr native_stream_car(context& ctx, const node_ptr& root)
+    {
+        if (root->length() != 2 || stream_is_empty(root->get(1)))
+        {
+            log_errorln("'stream-car' expects a non-empty stream: ", root);
+            return nullptr;
+        }
+
+        return root->get(1)->car;
+    }
+
+    node_ptr native_stream_map(context& ctx, const node_ptr& root)
+    {
+        if (root->length() != 3 || root->get(1) == nullptr || root->get(1)->proc == nullptr)
+        {
+            log_errorln("'stream-map' expects a procedure and a stream: ", root);
+            return nullptr;
+        }
+
+        return stream_map_from(ctx, root->get(1), root->get(2));
+    }
+
+    node_ptr native_stream_filter(context& ctx, const node_ptr& root)
+    {
+        if (root->length() != 3 || root->get(1) == nullptr || root->get(1)->proc == nullptr)
+        {
+            log_errorln("'stream-filter' expects a predicate and a stream: ", root);
+            return nullptr;
+        }
+
+        return stream_filter_from(ctx, root->get(1), take_argument(root, 2));
+    }
+
+    node_ptr native_stream_take(context& ctx, const node_ptr& root)
+    {
+        if (root->length() != 3 || root->get(2) == nullptr || root->get(2)->type != node_type::integer)
+        {
+            log_errorln("'stream-take' expects a stream and a count: ", root);
+            return nullptr;
+        }
+
+        node_ptr s = root->get(1);
+        int count = root->get(2)->to_int();
+
+        list_builder result;
+
+        // Only force what is consumed: the promise after the last element
+        // taken is left untouched
+        while (count > 0 && !stream_is_empty(s))
+        {
+            result.append(s->car);
+
+            if (--count > 0)
+            {
+                s = force(ctx, s->cdr);
+            }
+        }
+
+        return result.head;
+    }
+
+    node_ptr native_memoize(context& ctx, const node_ptr& root)
+    {
+        size_t len = root->length();
+        if (len < 2 || len > 3)
+        {
+            log_errorln("'memoize' expects a procedure and an optional capacity: ", root);
+            return nullptr;
+        }
+
+        node_ptr target = root->get(1);
+        if (target == nullptr || target->proc == nullptr ||
+            target->proc->is_macro || target->proc->form != opcode::none)
+        {
+            log_errorln("'memoize' expects a procedure: ", target);
+            return nullptr;
+        }
+
+        size_t capacity = 0;
+        if (len == 3)
+        {
+            node_ptr arg = root->get(2);
+            if (arg == nullptr || arg->type != node_type::integer || arg->to_int() <= 0)
+            {
+                log_errorln("'memoize' capacity must be a positive integer: ", arg);
+                return nullptr;
+            }
+            capacity = static_cast<size_t>(arg->to_int());
+        }
+
+        procedure_ptr func(std::make_shared<procedure>());
+        func->name = "memoize";
+        func->memo = std::make_shared<memo_cache>(target, capacity);
+
+        node_ptr result(std::make_shared<node>());
+        result->proc = func;
+
+        return result;
+    }
+
+    node_ptr native_memoize_stats(context& ctx, const node_ptr& root)
+    {
+        node_ptr func = root->get(1);
+        if (root->length() != 2 || func == nullptr || func->proc == nullptr || func->proc->memo == nullptr)
+        {
+            log_errorln("'memoize-stats' expects a memoized procedure: ", root);
+            return nullptr;
+        }
+
+        // (hits misses size)
+        const memo_cache& cache = *func->proc->memo;
+        node_ptr result;
+        size_t values[] = { cache.size(), cache.misses, cache.hits };
+        for (size_t value : values)
+        {
+            node_ptr n(std::make_shared<node>());
+            n->set_int(static_cast<int>(value));
+
+            node_ptr cell(std::make_shared<node>());
+            cell->type = node_type::pair;
+            cell->car = n;
+            cell->cdr = result;
+            result = cell;
+        }
+
+        return result;
+    }
+
+    // Items of the list 'root[index]', or false if it is not a list
+    bool parallel_items(const node_ptr& root, size_t index, std::vector<node_ptr>& items)
+    {
+        node_ptr n = root->get(index);
+        if (n != nullptr && n->type != node_type::pair)
+        {
+            return false;
+        }
+
+        for (; !stream_is_empty(n); n = n->cdr)
+        {
+            items.push_back(n->car);
+        }
+        return true;
+    }
+
+    // Calls 'func' on every item, concurrently when the context has a pool
+    void parallel_map(context& ctx, const node_ptr& func, const std::vector<node_ptr>& items, std::vector<node_ptr>& results)
+    {
+        results.resize(items.size());
+        parallel_for(ctx, items.size(), [&func, &items, &results](context& ctx, size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                results[i] = eval_procedure(ctx, func, stream_make_cell(items[i], nullptr));
+            }
+        });
+    }
+
+    node_ptr native_pmap(context& ctx, const node_ptr& root)
+    {
+        std::vector<node_ptr> items;
+        node_ptr func = root->get(1);
+        if (root->length() != 3 || func == nullptr || func->proc == nullptr || !parallel_items(root, 2, items))
+        {
+            log_errorln("'pmap' expects a procedure and a list: ", root);
+            return nullptr;
+        }
+
+        std::vector<node_ptr> results;
+        parallel_map(ctx, func, items, results);
+
+        list_builder result;
+        for (auto& value : results)
+        {
+            result.append(value);
+        }
+        return result.head;
+    }
+
+    node_ptr native_pfor_each(context& ctx, const node_ptr& root)
+    {
+        std::vector<node_ptr> items;
+        node_ptr func = root->get(1);
+        if (root->length() != 3 || func == nullptr || func->proc == nullptr || !parallel_items(root, 2, items))
+        {
+            log_errorln("'pfor-each' expects a procedure and a list: ", root);
+            return nullptr;
+        }
+
+        std::vector<node_ptr> results;
+        parallel_map(ctx, func, items, results);
+
+        return nullptr;
+    }
+
+    // Each chunk is reduced on its own, then the partial results are
+    // combined in order with the initial value: 'func' must be associative
+    node_ptr native_preduce(context& ctx, const node_ptr& root)
+    {
+        std::vector<node_ptr> items;
+        node_ptr func = root->get(1);
+        if (root->length() != 4 || func == nullptr || func->proc == nullptr || !parallel_items(root, 3, items))
+        {
+            log_errorln("'preduce' expects a procedure, an initial value and a list: ", root);
+            return nullptr;
+        }
+
+        // Partial result of the chunk starting at each index
+        std::vector<node_ptr> partials(items.size());
+        std::vector<char> has_partial(items.size(), 0);
+
+        parallel_for(ctx, items.size(), [&func, &items, &partials, &has_partial](context& ctx, size_t begin, size_t end)
+        {
+            if (begin == end)
+            {
+                return;
+            }
+
+            node_ptr value = items[begin];
+            for (size_t i = begin + 1; i < end; ++i)
+            {
+                value = eval_procedure(ctx, func, stream_make_cell(value, stream_make_cell(items[i], nullptr)));
+            }
+            partials[begin] = value;
+            has_partial[begin] = 1;
+        });
+
+        node_ptr result = root->get(2);
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            if (has_partial[i])
+            {
+                result = eval_procedure(ctx, func, stream_make_cell(result, stream_make_cell(partials[i], nullptr)));
+            }
+        }
+
+        return result;
+    }
+
+    node_ptr native_serialize(context& ctx, const node_ptr& root)
+    {
+        if (root->length() != 2)
+        {
+            log_errorln("'serialize' expects one argument: ", root);
+            return nullptr;
+        }
+
+        // The bytes are held in a string
+        node_ptr result(std::make_shared<node>());
+        result->type = node_type::string;
+        if (!serialize(root->get(1), result->value))
+        {
+            return nullptr;
+        }
+        return result;
+    }
+
+    node_ptr native_deserialize(context& ctx, const node_ptr& root)
+    {
+        node_ptr data = root->get(1);
+        if (root->length() != 2 || data == nullptr || data->type != node_type::string)
+        {
+            log_errorln("'deserialize' expects a string: ", root);
+            return nullptr;
+        }
+
+        node_ptr result;
+        deserialize(ctx, data->value, result);
+        return result;
+    }
+}
@@ -0,0 +1,50 @@
+#include "slist_observer.h"
+#include "slist_context.h"
+#include "slist_log.h"
+
+namespace
+{
+    std::string procedure_name(const slist::node_ptr& proc_node);
+}
+
+namespace slist
+{
+    void trace_observer::on_enter(context& ctx, const node_ptr& expr, const environment_ptr& env)
+    {
+        if (get_log_level() < log_level::trace)
+        {
+            return;
+        }
+
+        ctx.debug_dump_callstack();
+        log_traceln_slow("Eval: ", expr);
+        debug_print_environment(ctx, env);
+    }
+
+    void trace_observer::on_call(context& ctx, const node_ptr& proc_node, const node_ptr& args)
+    {
+        log_traceln_slow("Call: ", procedure_name(proc_node), " ", args);
+    }
+
+    void trace_observer::on_tail_call(context& ctx, const node_ptr& proc_node, const node_ptr& args)
+    {
+        log_traceln_slow("Tail call: ", procedure_name(proc_node), " ", args);
+    }
+
+    void trace_observer::on_exit(context& ctx, const node_ptr& proc_node, const node_ptr& value)
+    {
+        log_traceln_slow("Return: ", procedure_name(proc_node), " ", value);
+    }
+}
+
+namespace
+{
+    std::string procedure_name(const slist::node_ptr& proc_node)
+    {
+        if (proc_node == nullptr || proc_node->proc == nullptr || proc_node->proc->name.empty())
+        {
+            return "<procedure>";
+        }
+        return proc_node->proc->name;
+    }
+}
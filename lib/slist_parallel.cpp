@@ -0,0 +1,302 @@
+#include "slist_parallel.h"
+#include "slist_context.h"
+#include "slist_parser.h"
+
+#include <algorithm>
+#include <exception>
+
+namespace
+{
+    // Smaller sources are not worth splitting
+    const size_t min_parse_chunk = 256 * 1024;
+
+    // Tasks submitted by one call to 'thread_pool::run'
+    struct batch
+    {
+        explicit batch(size_t count) : remaining(count) {}
+
+        std::atomic<size_t> remaining;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    void run_task(batch& b, const slist::thread_pool::task& t);
+}
+
+namespace slist
+{
+    thread_pool::thread_pool(size_t thread_count)
+        : queued(0)
+        , next(0)
+        , is_stopping(false)
+    {
+        if (thread_count == 0)
+        {
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            queues.emplace_back(new queue());
+        }
+
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            threads.emplace_back(&thread_pool::worker, this, i);
+        }
+    }
+
+    thread_pool::~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            is_stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+    }
+
+    size_t thread_pool::size() const
+    {
+        return threads.size();
+    }
+
+    void thread_pool::run(std::vector<task>& tasks)
+    {
+        if (tasks.empty())
+        {
+            return;
+        }
+
+        auto b = std::make_shared<batch>(tasks.size());
+
+        // Counted before being pushed, so that a worker never takes a task
+        // that is not counted yet
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued += tasks.size();
+        }
+
+        for (auto& t : tasks)
+        {
+            queue& q = *queues[next++ % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.emplace_back([b, t]() { run_task(*b, t); });
+        }
+        wake.notify_all();
+
+        // Help until every task of the batch has been taken, then wait
+        // for the ones still running
+        task t;
+        while (b->remaining > 0 && steal(queues.size(), t))
+        {
+            t();
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(b->mutex);
+            b->done.wait(lock, [&b]() { return b->remaining == 0; });
+        }
+
+        if (b->error)
+        {
+            std::rethrow_exception(b->error);
+        }
+    }
+
+    bool thread_pool::pop(size_t index, task& t)
+    {
+        queue& q = *queues[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty())
+        {
+            return false;
+        }
+
+        t = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        --queued;
+        return true;
+    }
+
+    bool thread_pool::steal(size_t index, task& t)
+    {
+        for (size_t i = 1; i <= queues.size(); ++i)
+        {
+            queue& q = *queues[(index + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty())
+            {
+                t = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                --queued;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void thread_pool::worker(size_t index)
+    {
+        while (true)
+        {
+            task t;
+            if (pop(index, t) || steal(index, t))
+            {
+                t();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return is_stopping || queued > 0; });
+            if (is_stopping && queued == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    void parallel_for(context& ctx, size_t count, const range_callback& func)
+    {
+        size_t chunk_size = ctx.parallel_chunk_size;
+        if (ctx.pool != nullptr && chunk_size == 0)
+        {
+            // A few chunks per thread, so that stealing can balance uneven work
+            chunk_size = std::max<size_t>(1, count / (4 * (ctx.pool->size() + 1)));
+        }
+
+        if (ctx.pool == nullptr || count <= chunk_size)
+        {
+            func(ctx, 0, count);
+            return;
+        }
+
+        // Workers share the global environment read-only
+        ctx.global_env->load_image_bindings();
+
+        // Symbols first quoted by the workers, the same for all of them
+        auto worker_symbols = std::make_shared<context::shared_symbols_map>();
+
+        std::vector<thread_pool::task> tasks;
+        for (size_t begin = 0; begin < count; begin += chunk_size)
+        {
+            size_t end = std::min(count, begin + chunk_size);
+            tasks.push_back([&ctx, &func, &worker_symbols, begin, end]()
+            {
+                // Worker contexts have no pool: nested parallel calls run
+                // sequentially instead of waiting on the pool from within it
+                context worker(ctx.global_env);
+                worker.shadowed_forms = ctx.shadowed_forms;
+                worker.stack_size_limit = ctx.stack_size_limit;
+                worker.nesting_limit = ctx.nesting_limit;
+                worker.log = ctx.log;
+                worker.parent = &ctx;
+                worker.worker_symbols = worker_symbols;
+
+                func(worker, begin, end);
+            });
+        }
+
+        ctx.pool->run(tasks);
+
+        for (auto& keyval : worker_symbols->symbols)
+        {
+            ctx.symbols.emplace(keyval.first, keyval.second);
+        }
+    }
+
+    node_ptr parse_parallel(context& ctx, const char *data, size_t size)
+    {
+        if (ctx.pool == nullptr || size < 2 * min_parse_chunk)
+        {
+            return parse(data, size);
+        }
+
+        size_t chunk_size = std::max(min_parse_chunk, size / (4 * (ctx.pool->size() + 1)));
+        std::vector<size_t> offsets = split_forms(data, size, chunk_size);
+        if (offsets.size() <= 2)
+        {
+            return parse(data, size);
+        }
+
+        // Each range is a list of forms, joined to the next non-empty one
+        size_t count = offsets.size() - 1;
+        std::vector<node_ptr> heads(count);
+        std::vector<node *> tails(count, nullptr);
+
+        std::vector<thread_pool::task> tasks;
+        for (size_t i = 0; i < count; ++i)
+        {
+            tasks.push_back([&, i]()
+            {
+                heads[i] = parse(data + offsets[i], offsets[i + 1] - offsets[i]);
+                if (heads[i] != nullptr && heads[i]->car != nullptr)
+                {
+                    node *tail = heads[i].get();
+                    while (tail->cdr != nullptr)
+                    {
+                        tail = tail->cdr.get();
+                    }
+                    tails[i] = tail;
+                }
+            });
+        }
+        ctx.pool->run(tasks);
+
+        node_ptr result;
+        node *tail = nullptr;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (heads[i] == nullptr)
+            {
+                return nullptr;
+            }
+            if (tails[i] == nullptr)
+            {
+                continue;
+            }
+
+            if (tail == nullptr)
+            {
+                result = heads[i];
+            }
+            else
+            {
+                tail->cdr = heads[i];
+            }
+            tail = tails[i];
+        }
+
+        return (result != nullptr) ? result : heads[0];
+    }
+}
+
+namespace
+{
+    void run_task(batch& b, const slist::thread_pool::task& t)
+    {
+        try
+        {
+            t();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(b.mutex);
+            if (!b.error)
+            {
+                b.error = std::current_exception();
+            }
+        }
+
+        if (--b.remaining == 0)
+        {
+            std::lock_guard<std::mutex> lock(b.mutex);
+            b.done.notify_all();
+        }
+    }
+}
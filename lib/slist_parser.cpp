@@ -1,312 +1,749 @@
 #include "slist_parser.h"
+#include "slist_file.h"
 #include "slist_log.h"
+#include "slist_scan.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <iterator>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// The parser scans the source buffer in place: tokens are ranges of the
+// buffer, copied once into their node.  Lists being read are kept on an
+// explicit stack, so nesting depth does not use the C stack.
+
+namespace
+{
+	enum class char_class : unsigned char
+	{
+		token,   // Part of a name, number or boolean
+		space,
+		open,    // (
+		close,   // )
+		comment, // ; until the end of the line
+		string,  // "
+		quote,   // ' or , before a datum
+	};
+
+	struct char_table
+	{
+		char_table();
+
+		char_class classes[256];
+	};
+
+	const char_table table;
+
+	char_class classify(char ch);
+
+	// List being read: quote levels hold '(quote' and wait for one datum
+	struct level
+	{
+		level(const slist::node_ptr& head, bool is_quote);
+
+		slist::list_builder items;
+		bool is_quote;
+	};
 
-#include <cassert>
-#include <cctype>
-#include <fstream>
-#include <sstream>
-#include <stack>
-#include <iostream>
-
-namespace 
-{	
-	bool parse_expr(std::istream& in, slist::node_ptr& result);
-	bool parse_list(std::istream& in, slist::node_ptr& result);
-	bool parse_token(std::istream& in, slist::node_ptr& result);
-	bool parse_string(std::istream& in, slist::node_ptr& result);
-	bool parse_comment(std::istream& in);
-
-	slist::node_type find_type(const std::string& str);
-
-	bool get_next_char(std::istream& in, char& ch);
-	char peek_next_char(std::istream& in);
+	enum class parse_status
+	{
+		done,       // All the forms asked for were read, or the source ended
+		incomplete, // The buffer ends inside a form, more of it is needed
+		error,
+	};
+
+	// Appends up to 'max_forms' top-level forms to 'root'.  When 'is_final'
+	// is false, the buffer is only the beginning of the source.
+	parse_status parse_forms(const char *&p, const char *end, bool is_final, size_t max_forms, const slist::node_ptr& root);
+	bool build_forms(const char *data, const std::vector<slist::structural>& index, const slist::node_ptr& root);
+	slist::node_ptr read_token(const char *&p, const char *end);
+	slist::node_ptr read_string(const char *&p, const char *end, bool& is_closed);
+	slist::node_ptr make_token(const char *str, size_t size);
+	slist::node_ptr make_string(const char *str, size_t size);
+	slist::node_ptr make_quote(char ch);
+	bool skip_comment(const char *&p, const char *end);
+	void skip_token(const char *&p, const char *end);
+	void skip_string(const char *&p, const char *end);
+
+	slist::node_type find_type(const char *str, size_t size);
 }
 
 namespace slist
 {
 	node_ptr parse(const std::string& str)
 	{
-		std::istringstream in(str);
-		in >> std::noskipws;
+		return parse(str.data(), str.size());
+	}
 
+	node_ptr parse(const char *data, size_t size)
+	{
 		node_ptr result(std::make_shared<node>());
 		result->type = node_type::pair;
 
-		if (!parse_expr(in, result))
+		const char *p = data;
+		if (parse_forms(p, data + size, true, SIZE_MAX, result) != parse_status::done)
 		{
 			log_errorln("Could not parse expression");
 			return nullptr;
 		}
-        
+
 		return result;
 	}
 
 	node_ptr parse_stream(std::istream& in)
 	{
-		const size_t bufsize = 1024;
-		char buf[bufsize];
-
-		std::string str;
+		std::string str((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		return parse(str);
+	}
 
-		while (!in.eof())
+	node_ptr parse_file(const std::string& filename)
+	{
+		// Read from the mapping, without copying the file
+		mapped_file file;
+		if (!file.open(filename, file_access::sequential))
 		{
-			in.read(buf, bufsize);
-			str += std::string(buf, in.gcount());
+			log_errorln("Could not open file: ", filename);
+			return nullptr;
 		}
-
-		return parse(str);
+		return parse(file.data(), file.size());
 	}
 
-	node_ptr parse_file(const std::string& filename)
+	node_ptr parse_data(const char *data, size_t size)
 	{
-		std::ifstream in(filename);
-		return parse_stream(in);
+		std::vector<structural> index;
+		if (!scan_structure(data, size, best_scan_kernel(), index))
+		{
+			return parse(data, size);
+		}
+
+		node_ptr result(std::make_shared<node>());
+		result->type = node_type::pair;
+
+		if (!build_forms(data, index, result))
+		{
+			log_errorln("Could not parse expression");
+			return nullptr;
+		}
+
+		return result;
 	}
-}
 
-namespace 
-{
-	bool parse_expr(std::istream& in, slist::node_ptr& result)
+	std::vector<size_t> split_forms(const char *data, size_t size, size_t chunk_size)
 	{
-		using namespace slist;
+		std::vector<size_t> result(1, 0);
 
-		char ch;
+		const char *p = data;
+		const char *end = data + size;
+		size_t depth = 0;
+		bool is_quoted = false; // A top-level quote waits for its datum
 
-		while (true)
+		while (p != end)
 		{
-			if (!get_next_char(in, ch) || !in)
+			size_t offset = static_cast<size_t>(p - data);
+			if (depth == 0 && !is_quoted && offset - result.back() >= chunk_size)
 			{
-				break;
+				result.push_back(offset);
 			}
 
-			in.putback(ch);
-            
-            if (ch == ')')
-            {
-                break;
-            }
-			if (ch == '(')
+			switch (classify(*p))
 			{
-				node_ptr list(std::make_shared<node>());
-				list->type = node_type::pair;
+				case char_class::space:
+					++p;
+					break;
 
-				if (parse_list(in, list))
-				{
-					result->append(list);
-				}
-				else 
-				{
-					return false;
-				}
+				case char_class::comment:
+					skip_comment(p, end);
+					break;
+
+				case char_class::open:
+					++p;
+					++depth;
+					break;
+
+				case char_class::close:
+					if (depth == 0)
+					{
+						// 'parse' stops at an unbalanced ')'
+						end = p;
+						break;
+					}
+					++p;
+					if (--depth == 0)
+					{
+						is_quoted = false;
+					}
+					break;
+
+				case char_class::quote:
+					++p;
+					is_quoted = is_quoted || depth == 0;
+					break;
+
+				case char_class::string:
+					skip_string(p, end);
+					is_quoted = is_quoted && depth != 0;
+					break;
+
+				case char_class::token:
+					skip_token(p, end);
+					is_quoted = is_quoted && depth != 0;
+					break;
 			}
-			else if(ch == '"')
+		}
+
+		size_t last = static_cast<size_t>(end - data);
+		if (result.back() != last)
+		{
+			result.push_back(last);
+		}
+		return result;
+	}
+
+	form_reader::form_reader(const char *data, size_t size)
+		: p(data)
+		, end(data + size)
+		, is_eof(true)
+		, has_failed(false)
+	{
+	}
+
+	form_reader::form_reader(std::istream& in)
+		: p(nullptr)
+		, end(nullptr)
+		, is_eof(false)
+		, has_failed(false)
+	{
+		// Takes what the stream has buffered, and waits for one character
+		// only when there is none: 'read' would wait for 'size' characters,
+		// leaving complete forms unevaluated while a pipe trickles
+		source = [&in](char *data, size_t size) -> size_t
+		{
+			std::streambuf *buf = in.rdbuf();
+			if (buf == nullptr || size == 0)
 			{
-				node_ptr string_node(std::make_shared<node>());
-				if (parse_string(in, string_node))
-				{
-					result->append(string_node);
-				}
-				else 
+				return 0;
+			}
+
+			std::streamsize count = buf->in_avail();
+			if (count <= 0)
+			{
+				int ch = buf->sbumpc();
+				if (ch == std::char_traits<char>::eof())
 				{
-					log_errorln("Parse string failed");
-					return false;
+					in.setstate(std::ios::eofbit);
+					return 0;
 				}
+				data[0] = static_cast<char>(ch);
+				count = std::min<std::streamsize>(buf->in_avail(), static_cast<std::streamsize>(size - 1));
+				return 1 + static_cast<size_t>(count > 0 ? buf->sgetn(data + 1, count) : 0);
 			}
-			else if (ch == ';')
+
+			count = std::min<std::streamsize>(count, static_cast<std::streamsize>(size));
+			return static_cast<size_t>(buf->sgetn(data, count));
+		};
+	}
+
+	form_reader::form_reader(int fd)
+		: p(nullptr)
+		, end(nullptr)
+		, is_eof(false)
+		, has_failed(false)
+	{
+		source = [fd](char *data, size_t size)
+		{
+#if defined(_WIN32)
+			int count = _read(fd, data, static_cast<unsigned int>(size));
+#else
+			ssize_t count = ::read(fd, data, size);
+#endif
+			return (count > 0) ? static_cast<size_t>(count) : 0;
+		};
+	}
+
+	bool form_reader::next(node_ptr& form)
+	{
+		while (!has_failed)
+		{
+			node_ptr root(std::make_shared<node>());
+			root->type = node_type::pair;
+
+			const char *start = p;
+			switch (parse_forms(p, end, is_eof, 1, root))
 			{
-				parse_comment(in);
+				case parse_status::done:
+					form = root->car;
+					return form != nullptr;
+
+				case parse_status::incomplete:
+					p = start;
+					fill();
+					break;
+
+				case parse_status::error:
+					log_errorln("Could not parse expression");
+					has_failed = true;
+					break;
 			}
-			else
-			{
-				node_ptr token(std::make_shared<node>());
-				if (parse_token(in, token))
-				{
-					result->append(token);
-				}
-				else 
-				{
-					log_errorln("Parse token failed");
-					return false;
-				}
-			}				
 		}
+		return false;
+	}
 
-		return true;
+	bool form_reader::failed() const
+	{
+		return has_failed;
 	}
 
-	bool parse_list(std::istream& in, slist::node_ptr& result)
+	void form_reader::fill()
 	{
-		using namespace slist;
+		// Keeps the unread part only, moved to the front of the buffer,
+		// which only grows.  Sources return what is available without
+		// waiting for more, so that complete forms are evaluated at once.
+		size_t kept = static_cast<size_t>(end - p);
+		if (kept > 0 && p != buffer.data())
+		{
+			memmove(&buffer[0], p, kept);
+		}
+
+		size_t size = std::max<size_t>(64 * 1024, kept);
+		if (buffer.size() < kept + size)
+		{
+			buffer.resize(kept + size);
+		}
+		size_t count = source(&buffer[kept], size);
+		is_eof = (count == 0);
+
+		p = buffer.data();
+		end = p + kept + count;
+	}
+}
+
+namespace
+{
+	char_table::char_table()
+	{
+		for (auto& c : classes)
+		{
+			c = char_class::token;
+		}
 
-		std::string tok;
-		char ch = 0;
-
-		get_next_char(in, ch);
-		if (ch != '(')
-        {
-            log_errorln("Trying to parse a list that doesn't begin with '('");
-            return false;
-        }
-
-		bool parsed = parse_expr(in, result);
-        
-        if (parsed && (!get_next_char(in, ch) || ch != ')'))
-        {
-            log_errorln("List doesn't end with ')'");
-            return false;
-        }
-
-        return parsed;
+		for (unsigned char ch : { ' ', '\t', '\n', '\v', '\f', '\r' })
+		{
+			classes[ch] = char_class::space;
+		}
+
+		classes[static_cast<unsigned char>('(')] = char_class::open;
+		classes[static_cast<unsigned char>(')')] = char_class::close;
+		classes[static_cast<unsigned char>(';')] = char_class::comment;
+		classes[static_cast<unsigned char>('"')] = char_class::string;
+		classes[static_cast<unsigned char>('\'')] = char_class::quote;
+		classes[static_cast<unsigned char>(',')] = char_class::quote;
 	}
 
-	bool parse_token(std::istream& in, slist::node_ptr& result)
+	char_class classify(char ch)
+	{
+		return table.classes[static_cast<unsigned char>(ch)];
+	}
+
+	level::level(const slist::node_ptr& head, bool is_quote)
+		: items(head)
+		, is_quote(is_quote)
+	{
+	}
+
+	parse_status parse_forms(const char *&p, const char *end, bool is_final, size_t max_forms, const slist::node_ptr& root)
 	{
 		using namespace slist;
 
-		char ch = 0;
-		if (get_next_char(in, ch))
+		std::vector<level> levels;
+		levels.emplace_back(root, false);
+
+		size_t form_count = 0;
+		while (form_count < max_forms)
 		{
-			in.putback(ch);
+			while (p != end && classify(*p) == char_class::space)
+			{
+				++p;
+			}
 
-			std::string str;
+			node_ptr datum;
 
-			while (true)
+			if (p == end)
 			{
-				in.get(ch);
+				if (!is_final)
+				{
+					return parse_status::incomplete;
+				}
+				if (levels.size() == 1)
+				{
+					return parse_status::done;
+				}
+				if (!levels.back().is_quote)
+				{
+					log_errorln("List doesn't end with ')'");
+					return parse_status::error;
+				}
 
-				if (in && (ch == '\'' || ch == ','))
+				// Nothing left to quote
+				datum = std::make_shared<node>();
+				datum->set_name("");
+			}
+			else
+			{
+				switch (classify(*p))
 				{
-					result->type = node_type::pair;
+					case char_class::space: // Skipped above
+					case char_class::comment:
+						if (!skip_comment(p, end) && !is_final)
+						{
+							return parse_status::incomplete;
+						}
+						continue;
 
-					node_ptr sym(std::make_shared<node>());
-					sym->type = node_type::name;
-					sym->value = (ch == '\'') ? "quote" : "unquote";
+					case char_class::open:
+						{
+							++p;
+							node_ptr list(std::make_shared<node>());
+							list->type = node_type::pair;
+							levels.emplace_back(list, false);
+						}
+						continue;
 
-					result->append(sym);
+					case char_class::quote:
+						levels.emplace_back(make_quote(*p++), true);
+						continue;
 
-					char next_ch = peek_next_char(in);
-					if (next_ch == '(')
-					{
-						node_ptr sublist(std::make_shared<node>());
-						sublist->type = node_type::pair;
+					case char_class::close:
+						if (levels.back().is_quote)
+						{
+							// Nothing to quote before the end of the list
+							datum = std::make_shared<node>();
+							datum->set_name("");
+						}
+						else if (levels.size() == 1)
+						{
+							// Unbalanced ')': the forms read so far are the result
+							return parse_status::done;
+						}
+						else
+						{
+							++p;
+							datum = levels.back().items.head;
+							levels.pop_back();
+						}
+						break;
 
-						if (parse_list(in, sublist))
+					case char_class::string:
 						{
-							result->append(sublist);
+							bool is_closed = false;
+							datum = read_string(p, end, is_closed);
+							if (!is_closed && !is_final)
+							{
+								return parse_status::incomplete;
+							}
 						}
-					}
-					else 
-					{
-						node_ptr subname(std::make_shared<node>());
-						if (parse_token(in, subname))
+						break;
+
+					case char_class::token:
+						datum = read_token(p, end);
+						if (p == end && !is_final)
 						{
-							result->append(subname);
+							// The token may go on
+							return parse_status::incomplete;
 						}
-					}
-                    
-                    return true;
-				}
-				else if (in && ch != '(' && ch != ')' && !std::isspace(ch) && ch != ';')
-				{
-					str += ch;
+						break;
 				}
-				else 
+			}
+
+			// The datum completes the quotes waiting for it
+			while (true)
+			{
+				level& top = levels.back();
+				top.items.append(datum);
+				if (!top.is_quote)
 				{
-					if (ch == '(' || ch == ')' || ch == ';')
-					{
-						in.putback(ch);
-					}
 					break;
 				}
+				datum = top.items.head;
+				levels.pop_back();
 			}
 
-            result->type = find_type(str);
-            result->value = str;
-
-			return true;
+			if (levels.size() == 1)
+			{
+				++form_count;
+			}
 		}
 
-		return false;
+		return parse_status::done;
 	}
 
-	bool parse_string(std::istream& in, slist::node_ptr& result)
+	// Same as 'parse_forms', reading the elements of the index
+	bool build_forms(const char *data, const std::vector<slist::structural>& index, const slist::node_ptr& root)
 	{
 		using namespace slist;
 
-		char ch = '\0';
-		get_next_char(in, ch);
-		if (ch == '"')
+		std::vector<level> levels;
+		levels.emplace_back(root, false);
+
+		size_t i = 0;
+		while (true)
 		{
-			std::string str;
+			node_ptr datum;
 
-			while (true)
+			if (i == index.size())
 			{
-				in.get(ch);
-
-				if (!in)
+				if (levels.size() == 1)
 				{
-					break;
+					return true;
+				}
+				if (!levels.back().is_quote)
+				{
+					log_errorln("List doesn't end with ')'");
+					return false;
 				}
 
-				if (ch == '\\' && peek_next_char(in) == '"')
+				datum = std::make_shared<node>();
+				datum->set_name("");
+			}
+			else
+			{
+				const char *p = data + index[i].offset;
+				size_t size = index[i].size;
+
+				switch (classify(*p))
 				{
-					get_next_char(in, ch);
-					str += ch;
+					case char_class::open:
+						{
+							++i;
+							node_ptr list(std::make_shared<node>());
+							list->type = node_type::pair;
+							levels.emplace_back(list, false);
+						}
+						continue;
+
+					case char_class::quote:
+						++i;
+						levels.emplace_back(make_quote(*p), true);
+						continue;
+
+					case char_class::close:
+						if (levels.back().is_quote)
+						{
+							datum = std::make_shared<node>();
+							datum->set_name("");
+						}
+						else if (levels.size() == 1)
+						{
+							return true;
+						}
+						else
+						{
+							++i;
+							datum = levels.back().items.head;
+							levels.pop_back();
+						}
+						break;
+
+					case char_class::string:
+						++i;
+						datum = make_string(p, size);
+						break;
+
+					case char_class::space: // Not indexed
+					case char_class::comment:
+					case char_class::token:
+						++i;
+						datum = make_token(p, size);
+						break;
 				}
-				else if (ch == '"')
+			}
+
+			while (true)
+			{
+				level& top = levels.back();
+				top.items.append(datum);
+				if (!top.is_quote)
 				{
 					break;
 				}
+				datum = top.items.head;
+				levels.pop_back();
+			}
+		}
+	}
 
-				str += ch;
+	slist::node_ptr read_token(const char *&p, const char *end)
+	{
+		// Quotes and double quotes inside a token are part of it
+		const char *start = p;
+		skip_token(p, end);
+		return make_token(start, static_cast<size_t>(p - start));
+	}
+
+	slist::node_ptr read_string(const char *&p, const char *end, bool& is_closed)
+	{
+		using namespace slist;
+
+		node_ptr result(std::make_shared<node>());
+		result->type = node_type::string;
+
+		// Skip the opening '"', a string not closed ends with the source
+		++p;
+		while (p != end)
+		{
+			const char *start = p;
+			while (p != end && *p != '"' && *p != '\\')
+			{
+				++p;
 			}
+			result->value.append(start, p);
 
-			result->type = node_type::string;
-			result->value = str;
+			if (p == end)
+			{
+				break;
+			}
+
+			if (*p == '"')
+			{
+				++p;
+				is_closed = true;
+				break;
+			}
 
-			return true;
+			// Only '\"' and '\\' are escapes, other backslashes are kept.
+			// A backslash ending the buffer leaves the string open.
+			if (p + 1 == end)
+			{
+				result->value += *p++;
+				break;
+			}
+			if (p[1] == '"' || p[1] == '\\')
+			{
+				++p;
+			}
+			result->value += *p++;
+		}
+
+		return result;
+	}
+
+	slist::node_ptr make_token(const char *str, size_t size)
+	{
+		using namespace slist;
+
+		node_ptr result(std::make_shared<node>());
+		result->type = find_type(str, size);
+		result->value.assign(str, size);
+		if (result->type == node_type::name)
+		{
+			result->form = find_special_form(result->value);
+		}
+		return result;
+	}
+
+	// 'str' starts with the opening '"' and ends after the closing one, if any
+	slist::node_ptr make_string(const char *str, size_t size)
+	{
+		using namespace slist;
+
+		bool is_closed = (size >= 2 && str[size - 1] == '"');
+		if (!is_closed || memchr(str, '\\', size) != nullptr)
+		{
+			return read_string(str, str + size, is_closed);
+		}
+
+		node_ptr result(std::make_shared<node>());
+		result->type = node_type::string;
+		result->value.assign(str + 1, size - 2);
+		return result;
+	}
+
+	slist::node_ptr make_quote(char ch)
+	{
+		using namespace slist;
+
+		node_ptr result(std::make_shared<node>());
+		result->type = node_type::pair;
+
+		node_ptr sym(std::make_shared<node>());
+		sym->set_name((ch == '\'') ? "quote" : "unquote");
+		result->car = sym;
+
+		return result;
+	}
+
+	// Same rules as 'read_string'
+	void skip_token(const char *&p, const char *end)
+	{
+		while (p != end)
+		{
+			char_class c = classify(*p);
+			if (c == char_class::space || c == char_class::open ||
+				c == char_class::close || c == char_class::comment)
+			{
+				break;
+			}
+			++p;
 		}
-		return false;
 	}
 
-	bool parse_comment(std::istream& in)
+	void skip_string(const char *&p, const char *end)
 	{
-		char ch = '\0';
-		while (in && ch != '\n')
+		++p;
+		while (p != end)
 		{
-			in.get(ch);
+			if (*p == '"')
+			{
+				++p;
+				break;
+			}
+			if (*p == '\\' && p + 1 != end && (p[1] == '"' || p[1] == '\\'))
+			{
+				++p;
+			}
+			++p;
 		}
-		return true;
 	}
 
-	slist::node_type find_type(const std::string& str)
+	// Returns false when the buffer ends before the comment
+	bool skip_comment(const char *&p, const char *end)
+	{
+		const char *eol = static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+		p = (eol != nullptr) ? eol + 1 : end;
+		return eol != nullptr;
+	}
+
+	slist::node_type find_type(const char *str, size_t size)
 	{
 		using namespace slist;
-		node_type type = node_type::empty;
 
-		if (str == "true" || str == "false")
+		if ((size == 4 && memcmp(str, "true", 4) == 0) ||
+			(size == 5 && memcmp(str, "false", 5) == 0))
 		{
 			return node_type::boolean;
 		}
 
+		// Digits with at most one dot, after any number of '-'
 		int dot_count = 0;
 		bool has_only_digits = false;
-		bool has_alpha = false;
-		bool is_first_char = true;
 
-		for (char ch : str)
+		for (size_t i = 0; i < size; ++i)
 		{
-			if (std::isdigit(ch))
+			char ch = str[i];
+			if (ch >= '0' && ch <= '9')
 			{
-				has_only_digits = !has_alpha;
+				has_only_digits = true;
 			}
-			else if (ch == '-')
+			else if (ch == '-' && !has_only_digits)
 			{
-				if (has_only_digits)
-				{
-					has_only_digits = false;
-					break;
-				}
+				continue;
 			}
 			else if (ch == '.')
 			{
@@ -314,45 +751,19 @@ namespace
 			}
 			else
 			{
-				has_alpha = true;
-				has_only_digits = false;
-				break;
+				return node_type::name;
 			}
-
-			is_first_char = false;
 		}
 
 		if (has_only_digits && dot_count == 1)
 		{
-			type = node_type::number;
+			return node_type::number;
 		}
 		else if (has_only_digits && dot_count == 0)
 		{
-			type = node_type::integer;
-		}
-		else 
-		{
-			type = node_type::name;
+			return node_type::integer;
 		}
 
-		return type;
+		return node_type::name;
 	}
-	
-	bool get_next_char(std::istream& in, char& ch)
-	{
-		while (in)
-		{
-			ch = in.get();
-			if (std::isspace(ch) == 0)
-			{
-				return true;
-			}
-		}
-		return false;
-	}
-
-	char peek_next_char(std::istream& in)
-	{
-		return static_cast<char>(in.peek());
-	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,374 @@
+#include "slist_scan.h"
+
+#include <cstring>
+#include <limits>
+
+// The SIMD kernels are built on x86-64, where SSE2 is always available.
+// The AVX2 kernel is compiled for that target alone and only called when
+// the processor supports it.
+#if defined(__x86_64__) || defined(_M_X64)
+#define SLIST_SCAN_X86
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(SLIST_SCAN_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SLIST_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SLIST_TARGET_AVX2
+#endif
+
+namespace
+{
+    const size_t block_size = 64;
+
+    // Characters of a block, one bit per byte
+    struct block_masks
+    {
+        uint64_t space;   // Whitespace
+        uint64_t delim;   // Ends a token: whitespace, parentheses and ';'
+        uint64_t string;  // '"' and '\\', which end or escape in a string
+        uint64_t newline; // Ends a comment
+    };
+
+    typedef void (*classify_func)(const char *p, block_masks& m);
+
+    void classify_scalar(const char *p, block_masks& m);
+#ifdef SLIST_SCAN_X86
+    void classify_sse2(const char *p, block_masks& m);
+    SLIST_TARGET_AVX2 void classify_avx2(const char *p, block_masks& m);
+#endif
+
+    slist::scan_kernel detect_kernel();
+    unsigned first_bit(uint64_t mask);
+
+    enum class scan_state
+    {
+        between, // Whitespace, or before the next element
+        token,
+        string,
+        comment,
+    };
+}
+
+namespace slist
+{
+    scan_kernel best_scan_kernel()
+    {
+        static const scan_kernel kernel = detect_kernel();
+        return kernel;
+    }
+
+    bool scan_structure(const char *data, size_t size, scan_kernel kernel, std::vector<structural>& index)
+    {
+        index.clear();
+        if (size >= std::numeric_limits<uint32_t>::max())
+        {
+            return false;
+        }
+
+        // Never more than the processor supports
+        if (kernel > best_scan_kernel())
+        {
+            kernel = best_scan_kernel();
+        }
+
+        classify_func classify = &classify_scalar;
+#ifdef SLIST_SCAN_X86
+        if (kernel == scan_kernel::avx2)
+        {
+            classify = &classify_avx2;
+        }
+        else if (kernel == scan_kernel::sse2)
+        {
+            classify = &classify_sse2;
+        }
+#endif
+
+        auto add = [&index](size_t offset, size_t length)
+        {
+            structural s;
+            s.offset = static_cast<uint32_t>(offset);
+            s.size = static_cast<uint32_t>(length);
+            index.push_back(s);
+        };
+
+        scan_state state = scan_state::between;
+        size_t start = 0; // Of the token or string being read
+        size_t pos = 0;   // Next character to look at
+
+        char last_block[block_size];
+        for (size_t block = 0; block < size; block += block_size)
+        {
+            const char *p = data + block;
+            if (size - block < block_size)
+            {
+                // Padded with spaces, which end the last token
+                memset(last_block, ' ', block_size);
+                memcpy(last_block, p, size - block);
+                p = last_block;
+            }
+
+            block_masks m;
+            classify(p, m);
+
+            // An escape can move 'pos' one past the block
+            while (pos < block + block_size)
+            {
+                uint64_t from = ~0ull << (pos - block);
+
+                switch (state)
+                {
+                    case scan_state::between:
+                        {
+                            uint64_t bits = ~m.space & from;
+                            if (bits == 0)
+                            {
+                                pos = block + block_size;
+                                break;
+                            }
+
+                            pos = block + first_bit(bits);
+                            switch (p[pos - block])
+                            {
+                                case '(':
+                                case ')':
+                                case '\'':
+                                case ',':
+                                    add(pos, 1);
+                                    break;
+
+                                case ';':
+                                    state = scan_state::comment;
+                                    break;
+
+                                case '"':
+                                    state = scan_state::string;
+                                    start = pos;
+                                    break;
+
+                                default:
+                                    state = scan_state::token;
+                                    start = pos;
+                                    break;
+                            }
+                            ++pos;
+                        }
+                        break;
+
+                    case scan_state::token:
+                        {
+                            uint64_t bits = m.delim & from;
+                            if (bits == 0)
+                            {
+                                pos = block + block_size;
+                                break;
+                            }
+
+                            // The delimiter is looked at next
+                            pos = block + first_bit(bits);
+                            add(start, pos - start);
+                            state = scan_state::between;
+                        }
+                        break;
+
+                    case scan_state::string:
+                        {
+                            uint64_t bits = m.string & from;
+                            if (bits == 0)
+                            {
+                                pos = block + block_size;
+                                break;
+                            }
+
+                            pos = block + first_bit(bits);
+                            if (p[pos - block] == '"')
+                            {
+                                ++pos;
+                                add(start, pos - start);
+                                state = scan_state::between;
+                            }
+                            else
+                            {
+                                // Only '\"' and '\\' are escapes
+                                pos += (pos + 1 < size && (data[pos + 1] == '"' || data[pos + 1] == '\\')) ? 2 : 1;
+                            }
+                        }
+                        break;
+
+                    case scan_state::comment:
+                        {
+                            uint64_t bits = m.newline & from;
+                            if (bits == 0)
+                            {
+                                pos = block + block_size;
+                                break;
+                            }
+
+                            pos = block + first_bit(bits) + 1;
+                            state = scan_state::between;
+                        }
+                        break;
+                }
+            }
+        }
+
+        // Token or string not closed before the end
+        if (state == scan_state::token || state == scan_state::string)
+        {
+            add(start, size - start);
+        }
+
+        return true;
+    }
+}
+
+namespace
+{
+    // Bits of the scalar kernel's table
+    const unsigned char is_space = 1;
+    const unsigned char is_delim = 2;
+    const unsigned char is_string = 4;
+    const unsigned char is_newline = 8;
+
+    struct class_table
+    {
+        class_table()
+        {
+            memset(flags, 0, sizeof(flags));
+            for (unsigned char ch : { ' ', '\t', '\n', '\v', '\f', '\r' })
+            {
+                flags[ch] = is_space | is_delim;
+            }
+            flags[static_cast<unsigned char>('\n')] |= is_newline;
+            flags[static_cast<unsigned char>('(')] = is_delim;
+            flags[static_cast<unsigned char>(')')] = is_delim;
+            flags[static_cast<unsigned char>(';')] = is_delim;
+            flags[static_cast<unsigned char>('"')] = is_string;
+            flags[static_cast<unsigned char>('\\')] = is_string;
+        }
+
+        unsigned char flags[256];
+    };
+
+    const class_table table;
+
+    void classify_scalar(const char *p, block_masks& m)
+    {
+        m.space = 0;
+        m.delim = 0;
+        m.string = 0;
+        m.newline = 0;
+
+        for (size_t i = 0; i < block_size; ++i)
+        {
+            unsigned char f = table.flags[static_cast<unsigned char>(p[i])];
+            uint64_t bit = 1ull << i;
+            m.space |= (f & is_space) ? bit : 0;
+            m.delim |= (f & is_delim) ? bit : 0;
+            m.string |= (f & is_string) ? bit : 0;
+            m.newline |= (f & is_newline) ? bit : 0;
+        }
+    }
+
+#ifdef SLIST_SCAN_X86
+    void classify_sse2(const char *p, block_masks& m)
+    {
+        m.space = 0;
+        m.delim = 0;
+        m.string = 0;
+        m.newline = 0;
+
+        for (size_t i = 0; i < block_size; i += 16)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+
+            // '\t' to '\r' are 9 to 13: x - 9 <= 4, unsigned
+            __m128i t = _mm_sub_epi8(x, _mm_set1_epi8(9));
+            __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+            __m128i space = _mm_or_si128(control, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+
+            __m128i parens = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('(')), _mm_cmpeq_epi8(x, _mm_set1_epi8(')')));
+            __m128i delim = _mm_or_si128(_mm_or_si128(space, parens), _mm_cmpeq_epi8(x, _mm_set1_epi8(';')));
+            __m128i string = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+            __m128i newline = _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'));
+
+            m.space |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(space))) << i;
+            m.delim |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(delim))) << i;
+            m.string |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(string))) << i;
+            m.newline |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(newline))) << i;
+        }
+    }
+
+    SLIST_TARGET_AVX2 void classify_avx2(const char *p, block_masks& m)
+    {
+        m.space = 0;
+        m.delim = 0;
+        m.string = 0;
+        m.newline = 0;
+
+        for (size_t i = 0; i < block_size; i += 32)
+        {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+
+            __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8(9));
+            __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t);
+            __m256i space = _mm256_or_si256(control, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+
+            __m256i parens = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('(')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8(')')));
+            __m256i delim = _mm256_or_si256(_mm256_or_si256(space, parens), _mm256_cmpeq_epi8(x, _mm256_set1_epi8(';')));
+            __m256i string = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')));
+            __m256i newline = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'));
+
+            m.space |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(space))) << i;
+            m.delim |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(delim))) << i;
+            m.string |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(string))) << i;
+            m.newline |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(newline))) << i;
+        }
+    }
+#endif
+
+    slist::scan_kernel detect_kernel()
+    {
+#if defined(SLIST_SCAN_X86) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return slist::scan_kernel::avx2;
+        }
+        return slist::scan_kernel::sse2;
+#elif defined(SLIST_SCAN_X86) && defined(_MSC_VER)
+        // AVX2, and the system saving the AVX registers
+        int regs[4];
+        __cpuid(regs, 0);
+        if (regs[0] >= 7)
+        {
+            __cpuid(regs, 1);
+            bool has_xsave = (regs[2] & (1 << 27)) != 0;
+            __cpuidex(regs, 7, 0);
+            bool has_avx2 = (regs[1] & (1 << 5)) != 0;
+            if (has_xsave && has_avx2 && (_xgetbv(0) & 6) == 6)
+            {
+                return slist::scan_kernel::avx2;
+            }
+        }
+        return slist::scan_kernel::sse2;
+#else
+        return slist::scan_kernel::scalar;
+#endif
+    }
+
+    unsigned first_bit(uint64_t mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, mask);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
+    }
+}
@@ -0,0 +1,588 @@
+#include "slist_serialize.h"
+#include "slist_context.h"
+#include "slist_log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+// Encoding:
+//
+//   "SLB" u8 version, then one value: a u8 tag followed by its fields
+//
+// Lengths and numbers of symbols and pairs are unsigned varints, 7 bits
+// per byte, low bits first.  Integers are zigzag varints and doubles 8
+// bytes, little-endian.  Values are written in preorder: a pair is
+// followed by its car and its cdr, and a list of pairs that are not
+// shared by its count, its cars and the cdr of its last pair.
+
+namespace
+{
+    const char serialize_magic[3] = { 'S', 'L', 'B' };
+    const uint8_t serialize_version = 2;
+
+    enum class tag : uint8_t
+    {
+        nil = 0,
+        empty,
+        boolean_false,
+        boolean_true,
+        integer,      // zigzag varint
+        decimal,      // zigzag varint of the digits without the dot, u8 fraction digits
+        number,       // u8 fraction digits, f64: printed back with those digits
+        integer_text, // Integers and numbers whose text would not be printed
+        number_text,  // back the same, as length and characters
+        string,
+        symbol,       // length and characters, numbered in order
+        symbol_ref,   // number of a symbol already read
+        pair,         // car, cdr
+        list,         // count, cars, cdr of the last pair
+        shared_pair,  // car, cdr, numbered in order
+        pair_ref,     // number of a shared pair already read
+    };
+
+    void put_varint(std::string& out, uint64_t value);
+    void put_text(std::string& out, const std::string& text);
+    void put_double(std::string& out, double value);
+
+    bool get_varint(const char *&p, const char *end, uint64_t& value);
+    bool get_text(const char *&p, const char *end, std::string& text);
+    bool get_double(const char *&p, const char *end, double& value);
+
+    bool to_integer(const std::string& text, int64_t& value);
+    bool to_decimal(const std::string& text, int64_t& value, uint8_t& digits);
+    void print_decimal(int64_t value, uint8_t digits, std::string& text);
+    bool to_number(const std::string& text, double& value, uint8_t& digits);
+    void print_number(double value, uint8_t digits, std::string& text);
+}
+
+namespace slist
+{
+    bool serialize(const node_ptr& value, std::string& out)
+    {
+        out.append(serialize_magic, sizeof(serialize_magic));
+        out.push_back(static_cast<char>(serialize_version));
+
+        std::unordered_map<std::string, uint64_t> symbols;
+        std::unordered_map<const node *, uint64_t> shared_pairs;
+
+        // Fields still to write, the top one next
+        std::vector<const node_ptr *> pending(1, &value);
+        std::vector<const node_ptr *> cars;
+        while (!pending.empty())
+        {
+            const node_ptr& n = *pending.back();
+            pending.pop_back();
+
+            if (n == nullptr)
+            {
+                out.push_back(static_cast<char>(tag::nil));
+                continue;
+            }
+
+            if (n->proc != nullptr || n->promise != nullptr)
+            {
+                log_errorln("Cannot serialize procedures and promises: ", n);
+                return false;
+            }
+
+            switch (n->type)
+            {
+                case node_type::empty:
+                    out.push_back(static_cast<char>(tag::empty));
+                    break;
+
+                case node_type::boolean:
+                    out.push_back(static_cast<char>(n->to_bool() ? tag::boolean_true : tag::boolean_false));
+                    break;
+
+                case node_type::integer:
+                    {
+                        int64_t i = 0;
+                        if (to_integer(n->value, i))
+                        {
+                            out.push_back(static_cast<char>(tag::integer));
+                            put_varint(out, (static_cast<uint64_t>(i) << 1) ^ static_cast<uint64_t>(i >> 63));
+                        }
+                        else
+                        {
+                            out.push_back(static_cast<char>(tag::integer_text));
+                            put_text(out, n->value);
+                        }
+                    }
+                    break;
+
+                case node_type::number:
+                    {
+                        int64_t i = 0;
+                        double d = 0;
+                        uint8_t digits = 0;
+                        if (to_decimal(n->value, i, digits))
+                        {
+                            out.push_back(static_cast<char>(tag::decimal));
+                            put_varint(out, (static_cast<uint64_t>(i) << 1) ^ static_cast<uint64_t>(i >> 63));
+                            out.push_back(static_cast<char>(digits));
+                        }
+                        else if (to_number(n->value, d, digits))
+                        {
+                            out.push_back(static_cast<char>(tag::number));
+                            out.push_back(static_cast<char>(digits));
+                            put_double(out, d);
+                        }
+                        else
+                        {
+                            out.push_back(static_cast<char>(tag::number_text));
+                            put_text(out, n->value);
+                        }
+                    }
+                    break;
+
+                case node_type::string:
+                    out.push_back(static_cast<char>(tag::string));
+                    put_text(out, n->value);
+                    break;
+
+                case node_type::name:
+                    {
+                        auto it = symbols.find(n->value);
+                        if (it != symbols.end())
+                        {
+                            out.push_back(static_cast<char>(tag::symbol_ref));
+                            put_varint(out, it->second);
+                        }
+                        else
+                        {
+                            symbols.emplace(n->value, symbols.size());
+                            out.push_back(static_cast<char>(tag::symbol));
+                            put_text(out, n->value);
+                        }
+                    }
+                    break;
+
+                case node_type::pair:
+                    // Only pairs referred to more than once can be shared
+                    if (n.use_count() > 1)
+                    {
+                        auto it = shared_pairs.find(n.get());
+                        if (it != shared_pairs.end())
+                        {
+                            out.push_back(static_cast<char>(tag::pair_ref));
+                            put_varint(out, it->second);
+                            break;
+                        }
+                        shared_pairs.emplace(n.get(), shared_pairs.size());
+                        out.push_back(static_cast<char>(tag::shared_pair));
+                    }
+                    else if (n->cdr != nullptr && n->cdr.use_count() == 1 && n->cdr->type == node_type::pair)
+                    {
+                        // Follows the cdrs while nothing else refers to them
+                        const node *last = n.get();
+                        cars.clear();
+                        cars.push_back(&n->car);
+                        while (last->cdr != nullptr && last->cdr.use_count() == 1 &&
+                               last->cdr->type == node_type::pair &&
+                               last->cdr->proc == nullptr && last->cdr->promise == nullptr)
+                        {
+                            last = last->cdr.get();
+                            cars.push_back(&last->car);
+                        }
+
+                        out.push_back(static_cast<char>(tag::list));
+                        put_varint(out, cars.size());
+                        pending.push_back(&last->cdr);
+                        pending.insert(pending.end(), cars.rbegin(), cars.rend());
+                        break;
+                    }
+                    else
+                    {
+                        out.push_back(static_cast<char>(tag::pair));
+                    }
+                    pending.push_back(&n->cdr);
+                    pending.push_back(&n->car);
+                    break;
+
+                case node_type::promise:
+                    log_errorln("Cannot serialize procedures and promises: ", n);
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool deserialize(context& ctx, const char *data, size_t size, node_ptr& value)
+    {
+        const char *p = data;
+        const char *end = data + size;
+
+        value = nullptr;
+        if (size < sizeof(serialize_magic) + 1 ||
+            memcmp(p, serialize_magic, sizeof(serialize_magic)) != 0 ||
+            static_cast<uint8_t>(p[sizeof(serialize_magic)]) != serialize_version)
+        {
+            log_errorln("Invalid serialized data");
+            return false;
+        }
+        p += sizeof(serialize_magic) + 1;
+
+        std::vector<node_ptr> symbols;
+        std::vector<node_ptr> shared_pairs;
+
+        // Fields waiting for their value, the top one comes next
+        node_ptr result;
+        std::vector<node_ptr *> slots(1, &result);
+        while (!slots.empty())
+        {
+            node_ptr& slot = *slots.back();
+            slots.pop_back();
+
+            if (p == end)
+            {
+                log_errorln("Invalid serialized data");
+                return false;
+            }
+
+            bool is_valid = true;
+            tag t = static_cast<tag>(*p++);
+            switch (t)
+            {
+                case tag::nil:
+                    break;
+
+                case tag::empty:
+                    slot = std::make_shared<node>();
+                    break;
+
+                case tag::boolean_false:
+                case tag::boolean_true:
+                    slot = std::make_shared<node>();
+                    slot->set_bool(t == tag::boolean_true);
+                    break;
+
+                case tag::integer:
+                    {
+                        uint64_t u = 0;
+                        is_valid = get_varint(p, end, u);
+                        int64_t i = static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1);
+                        slot = std::make_shared<node>();
+                        slot->type = node_type::integer;
+                        slot->value = std::to_string(i);
+                    }
+                    break;
+
+                case tag::decimal:
+                    {
+                        uint64_t u = 0;
+                        is_valid = get_varint(p, end, u) && p != end;
+                        int64_t i = static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1);
+                        uint8_t digits = is_valid ? static_cast<uint8_t>(*p++) : 0;
+                        slot = std::make_shared<node>();
+                        slot->type = node_type::number;
+                        print_decimal(i, digits, slot->value);
+                    }
+                    break;
+
+                case tag::number:
+                    {
+                        double d = 0;
+                        uint8_t digits = (p != end) ? static_cast<uint8_t>(*p++) : 0;
+                        is_valid = get_double(p, end, d);
+                        slot = std::make_shared<node>();
+                        slot->type = node_type::number;
+                        print_number(d, digits, slot->value);
+                    }
+                    break;
+
+                case tag::integer_text:
+                case tag::number_text:
+                case tag::string:
+                    slot = std::make_shared<node>();
+                    slot->type = (t == tag::string) ? node_type::string :
+                                 (t == tag::integer_text) ? node_type::integer : node_type::number;
+                    is_valid = get_text(p, end, slot->value);
+                    break;
+
+                case tag::symbol:
+                    {
+                        std::string name;
+                        is_valid = get_text(p, end, name);
+                        slot = ctx.lookup_symbol(name);
+                        if (slot == nullptr)
+                        {
+                            slot = std::make_shared<node>();
+                            slot->set_name(name);
+                            slot = ctx.intern_symbol(slot);
+                        }
+                        symbols.push_back(slot);
+                    }
+                    break;
+
+                case tag::symbol_ref:
+                    {
+                        uint64_t index = 0;
+                        is_valid = get_varint(p, end, index) && index < symbols.size();
+                        if (is_valid)
+                        {
+                            slot = symbols[index];
+                        }
+                    }
+                    break;
+
+                case tag::pair:
+                case tag::shared_pair:
+                    slot = std::make_shared<node>();
+                    slot->type = node_type::pair;
+                    if (t == tag::shared_pair)
+                    {
+                        shared_pairs.push_back(slot);
+                    }
+                    slots.push_back(&slot->cdr);
+                    slots.push_back(&slot->car);
+                    break;
+
+                case tag::list:
+                    {
+                        // Each car takes at least one byte
+                        uint64_t count = 0;
+                        is_valid = get_varint(p, end, count) && count > 0 &&
+                                   count <= static_cast<uint64_t>(end - p);
+                        if (!is_valid)
+                        {
+                            break;
+                        }
+
+                        size_t first = slots.size();
+                        slots.resize(first + count + 1);
+                        node_ptr *next = &slot;
+                        for (uint64_t i = 0; i < count; ++i)
+                        {
+                            *next = std::make_shared<node>();
+                            (*next)->type = node_type::pair;
+                            slots[first + count - i] = &(*next)->car;
+                            next = &(*next)->cdr;
+                        }
+                        slots[first] = next;
+                    }
+                    break;
+
+                case tag::pair_ref:
+                    {
+                        uint64_t index = 0;
+                        is_valid = get_varint(p, end, index) && index < shared_pairs.size();
+                        if (is_valid)
+                        {
+                            slot = shared_pairs[index];
+                        }
+                    }
+                    break;
+
+                default:
+                    is_valid = false;
+                    break;
+            }
+
+            if (!is_valid)
+            {
+                log_errorln("Invalid serialized data");
+                return false;
+            }
+        }
+
+        if (p != end)
+        {
+            log_errorln("Invalid serialized data");
+            return false;
+        }
+
+        value = result;
+        return true;
+    }
+
+    bool deserialize(context& ctx, const std::string& data, node_ptr& value)
+    {
+        return deserialize(ctx, data.data(), data.size(), value);
+    }
+}
+
+namespace
+{
+    void put_varint(std::string& out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    void put_text(std::string& out, const std::string& text)
+    {
+        put_varint(out, text.size());
+        out.append(text);
+    }
+
+    void put_double(std::string& out, double value)
+    {
+        uint64_t bits = 0;
+        memcpy(&bits, &value, sizeof(bits));
+        for (int i = 0; i < 8; ++i)
+        {
+            out.push_back(static_cast<char>((bits >> (8 * i)) & 0xff));
+        }
+    }
+
+    bool get_varint(const char *&p, const char *end, uint64_t& value)
+    {
+        value = 0;
+        for (unsigned shift = 0; p != end && shift < 64; shift += 7)
+        {
+            uint8_t byte = static_cast<uint8_t>(*p++);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool get_text(const char *&p, const char *end, std::string& text)
+    {
+        uint64_t size = 0;
+        if (!get_varint(p, end, size) || static_cast<uint64_t>(end - p) < size)
+        {
+            return false;
+        }
+        text.assign(p, static_cast<size_t>(size));
+        p += size;
+        return true;
+    }
+
+    bool get_double(const char *&p, const char *end, double& value)
+    {
+        if (end - p < 8)
+        {
+            return false;
+        }
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            bits |= static_cast<uint64_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+        }
+        memcpy(&value, &bits, sizeof(value));
+        p += 8;
+        return true;
+    }
+
+    // True when 'text' is what std::to_string prints for its value
+    bool to_integer(const std::string& text, int64_t& value)
+    {
+        size_t first = (!text.empty() && text[0] == '-') ? 1 : 0;
+        size_t digits = text.size() - first;
+        if (digits == 0 || digits > 19 || (text[first] == '0' && (digits > 1 || first == 1)))
+        {
+            return false;
+        }
+        for (size_t i = first; i < text.size(); ++i)
+        {
+            if (text[i] < '0' || text[i] > '9')
+            {
+                return false;
+            }
+        }
+
+        errno = 0;
+        value = strtoll(text.c_str(), nullptr, 10);
+        return errno == 0;
+    }
+
+    // True when 'text' is a decimal number of at most 18 digits that
+    // 'print_decimal' prints back the same, with no leading zeros
+    bool to_decimal(const std::string& text, int64_t& value, uint8_t& digits)
+    {
+        size_t first = (!text.empty() && text[0] == '-') ? 1 : 0;
+        size_t dot = text.find('.');
+        if (dot == std::string::npos || dot == first || dot + 1 == text.size() || text.size() - first > 19)
+        {
+            return false;
+        }
+
+        uint64_t u = 0;
+        for (size_t i = first; i < text.size(); ++i)
+        {
+            if (i == dot)
+            {
+                continue;
+            }
+            if (text[i] < '0' || text[i] > '9')
+            {
+                return false;
+            }
+            u = u * 10 + static_cast<uint64_t>(text[i] - '0');
+        }
+
+        value = first ? -static_cast<int64_t>(u) : static_cast<int64_t>(u);
+        digits = static_cast<uint8_t>(text.size() - dot - 1);
+
+        std::string printed;
+        print_decimal(value, digits, printed);
+        return printed == text;
+    }
+
+    // Prints the digits of 'value' with a dot before the last 'digits'
+    void print_decimal(int64_t value, uint8_t digits, std::string& text)
+    {
+        // Up to 255 fraction digits, the dot, 20 digits and the sign
+        char buffer[280];
+        char *end = buffer + sizeof(buffer);
+        char *p = end;
+
+        uint64_t u = (value < 0) ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+        for (unsigned i = 0; i < digits; ++i)
+        {
+            *--p = static_cast<char>('0' + u % 10);
+            u /= 10;
+        }
+        *--p = '.';
+        do
+        {
+            *--p = static_cast<char>('0' + u % 10);
+            u /= 10;
+        }
+        while (u != 0);
+        if (value < 0)
+        {
+            *--p = '-';
+        }
+        text.assign(p, end - p);
+    }
+
+    // True when printing the value with the digits after the dot of
+    // 'text' gives 'text' back
+    bool to_number(const std::string& text, double& value, uint8_t& digits)
+    {
+        size_t dot = text.find('.');
+        if (dot == std::string::npos || text.size() - dot - 1 > 17)
+        {
+            return false;
+        }
+
+        digits = static_cast<uint8_t>(text.size() - dot - 1);
+        value = strtod(text.c_str(), nullptr);
+
+        std::string printed;
+        print_number(value, digits, printed);
+        return printed == text;
+    }
+
+    void print_number(double value, uint8_t digits, std::string& text)
+    {
+        char buffer[512];
+        int size = snprintf(buffer, sizeof(buffer), "%.*f", static_cast<int>(digits), value);
+        text.assign(buffer, (size > 0) ? std::min<size_t>(size, sizeof(buffer) - 1) : 0);
+    }
+}
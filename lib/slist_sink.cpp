@@ -0,0 +1,178 @@
+#include "slist_sink.h"
+
+#include <cerrno>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+    void write_fd(int fd, const char *data, size_t size);
+    bool is_terminal(int fd);
+}
+
+namespace slist
+{
+    output_sink::~output_sink()
+    {
+    }
+
+    void output_sink::flush()
+    {
+    }
+
+    buffered_sink::buffered_sink(size_t capacity, bool is_line_buffered)
+        : capacity(capacity)
+        , is_line_buffered(is_line_buffered)
+    {
+        buffer.reserve(capacity);
+    }
+
+    void buffered_sink::write(const char *data, size_t size)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (buffer.size() + size > capacity)
+        {
+            write_through(buffer.data(), buffer.size());
+            buffer.clear();
+
+            // Too large to be worth copying
+            if (size >= capacity)
+            {
+                write_through(data, size);
+                return;
+            }
+        }
+
+        buffer.append(data, size);
+
+        if (is_line_buffered && memchr(data, '\n', size) != nullptr)
+        {
+            write_through(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+
+    void buffered_sink::flush()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (!buffer.empty())
+        {
+            write_through(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+
+    void buffered_sink::set_line_buffered(bool value)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        is_line_buffered = value;
+    }
+
+    fd_sink::fd_sink(int fd, size_t capacity, bool is_line_buffered)
+        : buffered_sink(capacity, is_line_buffered)
+        , fd(fd)
+    {
+    }
+
+    fd_sink::~fd_sink()
+    {
+        flush();
+    }
+
+    void fd_sink::write_through(const char *data, size_t size)
+    {
+        write_fd(fd, data, size);
+    }
+
+    callback_sink::callback_sink(callback func, size_t capacity, bool is_line_buffered)
+        : buffered_sink(capacity, is_line_buffered)
+        , func(std::move(func))
+    {
+    }
+
+    callback_sink::~callback_sink()
+    {
+        flush();
+    }
+
+    void callback_sink::write_through(const char *data, size_t size)
+    {
+        if (func && size > 0)
+        {
+            func(data, size);
+        }
+    }
+
+    void string_sink::write(const char *data, size_t size)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        text.append(data, size);
+    }
+
+    std::string string_sink::str() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return text;
+    }
+
+    void string_sink::clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        text.clear();
+    }
+
+    const output_sink_ptr& stdout_sink()
+    {
+        // Flushed when destroyed at exit
+        static const output_sink_ptr sink = std::make_shared<fd_sink>(1, 64 * 1024, is_terminal(1));
+        return sink;
+    }
+
+    const output_sink_ptr& stderr_sink()
+    {
+        static const output_sink_ptr sink = std::make_shared<fd_sink>(2, 4 * 1024, true);
+        return sink;
+    }
+}
+
+namespace
+{
+    void write_fd(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+#if defined(_WIN32)
+            int written = _write(fd, data, static_cast<unsigned>(size > 0x40000000 ? 0x40000000 : size));
+#else
+            ssize_t written = ::write(fd, data, size);
+#endif
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                // Nowhere to report it: the output is lost, like with stdio
+                return;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    bool is_terminal(int fd)
+    {
+#if defined(_WIN32)
+        return _isatty(fd) != 0;
+#else
+        return isatty(fd) != 0;
+#endif
+    }
+}
@@ -0,0 +1,163 @@
+#include "slist_trace.h"
+#include "slist_context.h"
+#include "slist_log.h"
+
+#include <cstdio>
+#include <unordered_map>
+
+namespace
+{
+    const char *event_name(slist::trace_event event);
+    void name_procedures(const slist::context& ctx, std::unordered_map<uint32_t, std::string>& names);
+}
+
+namespace slist
+{
+    trace_buffer::trace_buffer(size_t capacity)
+        : start_ticks(trace_ticks())
+        , start_time(std::chrono::steady_clock::now())
+        , mask(0)
+        , next(0)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        mask = size - 1;
+
+        slots.reset(new slot[size]);
+        for (size_t i = 0; i < size; ++i)
+        {
+            slots[i].number.store(0, std::memory_order_relaxed);
+            slots[i].time.store(0, std::memory_order_relaxed);
+            slots[i].data.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    std::vector<trace_entry> trace_buffer::entries() const
+    {
+        uint64_t end = next.load(std::memory_order_acquire);
+        uint64_t begin = (end > capacity()) ? end - capacity() : 0;
+
+        // Length of a tick, measured since the creation of the buffer
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start_time;
+        int64_t elapsed_ticks = trace_ticks() - start_ticks;
+        double tick_ns = (elapsed_ticks > 0) ? elapsed.count() / elapsed_ticks : 0.0;
+
+        std::vector<trace_entry> result;
+        result.reserve(static_cast<size_t>(end - begin));
+        for (uint64_t index = begin; index < end; ++index)
+        {
+            const slot& s = slots[index & mask];
+
+            uint64_t number = s.number.load(std::memory_order_acquire);
+            int64_t time = s.time.load(std::memory_order_relaxed);
+            uint64_t data = s.data.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            // Overwritten by newer entries while being read
+            if (number != index + 1 || s.number.load(std::memory_order_relaxed) != number)
+            {
+                continue;
+            }
+
+            trace_entry e;
+            std::chrono::duration<double, std::nano> since_start((time - start_ticks) * tick_ns);
+            e.time = start_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(since_start);
+            e.proc_id = static_cast<uint32_t>(data >> 8);
+            e.event = static_cast<trace_event>(data & 0xff);
+            result.push_back(e);
+        }
+        return result;
+    }
+
+    std::string format_trace(const context& ctx, size_t max_entries)
+    {
+        if (ctx.trace == nullptr)
+        {
+            return "";
+        }
+
+        std::vector<trace_entry> entries = ctx.trace->entries();
+        if (entries.size() > max_entries)
+        {
+            entries.erase(entries.begin(), entries.end() - max_entries);
+        }
+        if (entries.empty())
+        {
+            return "";
+        }
+
+        std::unordered_map<uint32_t, std::string> names;
+        name_procedures(ctx, names);
+
+        std::string out = "Last " + std::to_string(entries.size()) + " calls and returns:\n";
+        for (const trace_entry& e : entries)
+        {
+            std::chrono::duration<double, std::micro> elapsed = e.time - entries.front().time;
+
+            char line[64];
+            snprintf(line, sizeof(line), "%12.3f us  %-12s", elapsed.count(), event_name(e.event));
+            out += line;
+
+            auto it = names.find(e.proc_id);
+            if (it != names.end())
+            {
+                out += it->second;
+            }
+            else
+            {
+                out += "procedure #" + std::to_string(e.proc_id);
+            }
+            out += '\n';
+        }
+        return out;
+    }
+
+    void dump_trace(const context& ctx, size_t max_entries)
+    {
+        log_settings settings = ctx.log;
+        log_scope scope(settings);
+        if (is_log_enabled(log_level::error))
+        {
+            log_error(format_trace(ctx, max_entries));
+        }
+    }
+}
+
+namespace
+{
+    const char *event_name(slist::trace_event event)
+    {
+        using namespace slist;
+
+        switch (event)
+        {
+            case trace_event::call:        return "call";
+            case trace_event::tail_call:   return "tail call";
+            case trace_event::native_call: return "native call";
+            case trace_event::exit:        return "return";
+        }
+        return "?";
+    }
+
+    // Names of the procedures bound in the global environments, the
+    // innermost binding first
+    void name_procedures(const slist::context& ctx, std::unordered_map<uint32_t, std::string>& names)
+    {
+        using namespace slist;
+
+        for (const environment *env = ctx.global_env.get(); env != nullptr; env = env->parent.get())
+        {
+            for (auto& keyval : env->bindings)
+            {
+                const node_ptr& n = keyval.second;
+                if (n != nullptr && n->proc != nullptr)
+                {
+                    names.emplace(n->proc->id, keyval.first);
+                }
+            }
+        }
+    }
+}
@@ -1,14 +1,51 @@
 #include "slist_types.h"
 #include "slist_log.h"
 #include "slist_context.h"
+#include "slist_image.h"
 #include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace
+{
+	slist::node_ptr release_next(slist::node& n, std::vector<slist::node_ptr>& nested);
+
+	// Procedures are made on any thread
+	std::atomic<uint32_t> next_procedure_id(1);
+}
 
 namespace slist
 {
 	node::node()
 		: type(node_type::empty)
-		, is_tail(false)
+		, form(opcode::none)
+		, is_constant(false)
+	{
+	}
+
+	node::~node()
 	{
+		// Release the cdr chain iteratively: the default destructor would
+		// recurse once per element and overflow the stack on long lists
+		// and streams.  Nested lists wait in 'nested', so that deep trees
+		// do not recurse either.
+		std::vector<node_ptr> nested;
+		node_ptr next = release_next(*this, nested);
+		while (true)
+		{
+			while (next != nullptr && next.use_count() == 1)
+			{
+				node_ptr after = release_next(*next, nested);
+				next = std::move(after);
+			}
+
+			if (nested.empty())
+			{
+				break;
+			}
+			next = std::move(nested.back());
+			nested.pop_back();
+		}
 	}
 
 	size_t node::length() const
@@ -60,6 +97,41 @@ namespace slist
 		p->cdr = next;
 	}
 
+	list_builder::list_builder()
+		: head(std::make_shared<node>())
+		, tail(head.get())
+		, is_empty(true)
+	{
+		head->type = node_type::pair;
+	}
+
+	list_builder::list_builder(const node_ptr& head)
+		: head(head)
+		, tail(head.get())
+		, is_empty(head->car == nullptr && head->cdr == nullptr)
+	{
+		while (tail->cdr != nullptr)
+		{
+			tail = tail->cdr.get();
+		}
+	}
+
+	void list_builder::append(const node_ptr& n)
+	{
+		if (is_empty)
+		{
+			tail->car = n;
+			is_empty = false;
+			return;
+		}
+
+		node_ptr next(std::make_shared<node>());
+		next->type = node_type::pair;
+		next->car = n;
+		tail->cdr = next;
+		tail = next.get();
+	}
+
 	node_ptr node::pop()
 	{
 		if (cdr == nullptr)
@@ -83,7 +155,7 @@ namespace slist
 	{
 		if (type != node_type::boolean)
 		{
-			log_errorln(std::string("Cannot convert to boolean, invalid type: ") + std::to_string((int)type));
+			log_errorln("Cannot convert to boolean, invalid type: ", (int)type);
 			return false;
 		}
 		std::string v = value;
@@ -101,7 +173,7 @@ namespace slist
 	{
 		if (type != node_type::integer) 
 		{
-			log_errorln(std::string("Cannot convert to int, invalid type: ") + std::to_string((int)type));
+			log_errorln("Cannot convert to int, invalid type: ", (int)type);
 			return 0;
 		}
 		return std::stoi(value);
@@ -118,7 +190,7 @@ namespace slist
 		if (type != node_type::integer && 
 			type != node_type::number)
 		{
-			log_errorln(std::string("Cannot convert to float, invalid type: ") + std::to_string((int)type));
+			log_errorln("Cannot convert to float, invalid type: ", (int)type);
 
 			return 0;			
 		}
@@ -140,6 +212,7 @@ namespace slist
 	{
 		type = node_type::name;
 		value = str;
+		form = find_special_form(str);
 	}
 
 	const std::string& node::to_string() const
@@ -153,25 +226,39 @@ namespace slist
 		value = str;
 	}
 
-	void node::set_as_tail()
+	opcode find_special_form(const std::string& name)
 	{
-		is_tail = true;
-		if (proc != nullptr)
+		static const std::unordered_map<std::string, opcode> forms =
 		{
-			proc->is_tail = true;
-			if (proc->body != nullptr)
-			{
-				proc->body->set_as_tail();
-			}
-		}
+			{ "quote",       opcode::quote },
+			{ "'",           opcode::quote },
+			{ "lambda",      opcode::lambda },
+			{ "define",      opcode::define },
+			{ "defmacro",    opcode::defmacro },
+			{ "set!",        opcode::set },
+			{ "let",         opcode::let },
+			{ "letrec",      opcode::letrec },
+			{ "begin",       opcode::begin },
+			{ "if",          opcode::branch },
+			{ "eval",        opcode::eval },
+			{ "apply",       opcode::apply },
+			{ "delay",       opcode::delay },
+			{ "force",       opcode::force },
+			{ "stream-cons", opcode::stream_cons },
+			{ "stream-cdr",  opcode::stream_cdr },
+		};
+
+		auto it = forms.find(name);
+		return (it != forms.end()) ? it->second : opcode::none;
 	}
 
 	procedure::procedure()
-		 : is_native(false)
+		 : id(next_procedure_id++)
+		 , is_native(false)
 		 , is_macro(false)
-		 , is_tail(false)
+		 , is_strict(false)
+		 , form(opcode::none)
 	 {
-	 	env = std::make_shared<environment>();
 	 }
 
 	void environment::register_variable(const std::string& name, node_ptr n)
@@ -181,10 +268,10 @@ namespace slist
 
 	node_ptr environment::lookup_variable(const std::string& name)
 	{
-		auto it = bindings.find(name);
-		if (it != bindings.end())
+		node_ptr *n = find_binding(name);
+		if (n != nullptr)
 		{
-			return it->second;
+			return *n;
 		}
 
 		auto p = parent;
@@ -198,21 +285,66 @@ namespace slist
 
 	bool environment::set_variable(const std::string& name, node_ptr n)
 	{
+		// Global environment of a fork: the global environments past it
+		// are shared, and are copied on write
+		environment *overlay = nullptr;
+
 		environment *env = this;
 		while (env != nullptr)
 		{
-			auto it = env->bindings.find(name);
-			if (it != env->bindings.end())
+			node_ptr *value = env->find_binding(name);
+			if (value != nullptr)
 			{
-				it->second = n;
+				if (overlay != nullptr && env->is_global)
+				{
+					overlay->bindings[name] = n;
+				}
+				else
+				{
+					*value = n;
+				}
 				return true;
 			}
 
+			if (overlay == nullptr && env->is_global)
+			{
+				overlay = env;
+			}
+
 			env = env->parent.get();
 		}
 		return false;
 	}
 
+	void environment::load_image_bindings()
+	{
+		for (environment *env = this; env != nullptr; env = env->parent.get())
+		{
+			if (env->image != nullptr)
+			{
+				env->image->take_all(env->bindings);
+				env->image = nullptr;
+			}
+		}
+	}
+
+	node_ptr *environment::find_binding(const std::string& name)
+	{
+		auto it = bindings.find(name);
+		if (it != bindings.end())
+		{
+			return &it->second;
+		}
+
+		node_ptr value;
+		if (image != nullptr && image->take(name, value))
+		{
+			return &(bindings[name] = value);
+		}
+
+		return nullptr;
+	}
+
 	void print_node(const node_ptr& n)
 	{
 		debug_print_node(n);
@@ -220,25 +352,30 @@ namespace slist
 
 	void debug_print_node(const node_ptr& n, int indent)
 	{
+		if (!is_log_enabled(log_level::trace))
+		{
+			return;
+		}
+
 		for (int i = 0; i < indent; ++i)
 		{
-			LOG_TRACE("    ");
+			log_trace_slow("    ");
 		}
 
 		if (n == nullptr)
 		{
-			LOG_TRACELN("nil");
+			log_traceln_slow("nil");
             return;
 		}
 
-		LOG_TRACE("[" + type_to_string(n->type) + "]");		
+		log_trace_slow("[", type_to_string(n->type), "]");
 
 		if (n->value.length() > 0)
 		{
-			LOG_TRACE(" \"" + n->value + "\"");
+			log_trace_slow(" \"", n->value, "\"");
 		}
 
-		LOG_TRACELN();
+		log_traceln_slow();
 
 		if (n->type == node_type::pair)
 		{
@@ -253,19 +390,19 @@ namespace slist
 		{
 			return;
 		}
-		else if (env == ctx.global_env)
+		else if (env->is_global)
 		{
-			LOG_TRACELN("<globals>");
+			log_traceln_slow("<globals>");
 			return;
 		}
 
-		LOG_TRACE("[");
+		log_trace_slow("[");
 		for (auto& keyval : env->bindings)
 		{
-			LOG_TRACE(keyval.first + ": ");
+			log_trace_slow(keyval.first, ": ");
             if (keyval.second == nullptr)
             {
-                LOG_TRACE("<null>");
+                log_trace_slow("<null>");
                 continue;
             }
 			auto proc = keyval.second->proc;
@@ -273,20 +410,20 @@ namespace slist
 			{
 				if (proc->is_native)
 				{
-					LOG_TRACE("<native func>");
+					log_trace_slow("<native func>");
 				}
 				else 
 				{
-					LOG_TRACE2("", proc->body);
+					log_trace_slow("", proc->body);
 				}
 			}
 			else 
 			{
-				LOG_TRACE(keyval.second->value);
+				log_trace_slow(keyval.second->value);
 			}
-			LOG_TRACE(", ");
+			log_trace_slow(", ");
 		}
-		LOG_TRACE("]");
+		log_trace_slow("]");
 		debug_print_environment(ctx, env->parent);
 	}
 
@@ -303,8 +440,32 @@ namespace slist
 			case node_type::number:  return "number";
 			case node_type::name:    return "name";
 			case node_type::string:  return "string";
+			case node_type::promise: return "promise";
 		}
 
 		return "<undefined>";
 	}
-}
\ No newline at end of file
+}
+
+namespace
+{
+	slist::node_ptr release_next(slist::node& n, std::vector<slist::node_ptr>& nested)
+	{
+		const slist::node_ptr& car = n.car;
+		if (car != nullptr && car.use_count() == 1 && (car->car != nullptr || car->cdr != nullptr))
+		{
+			nested.push_back(std::move(n.car));
+		}
+
+		if (n.cdr != nullptr)
+		{
+			return std::move(n.cdr);
+		}
+		if (n.promise != nullptr && n.promise.use_count() == 1)
+		{
+			// Forced stream tail
+			return std::move(n.promise->value);
+		}
+		return nullptr;
+	}
+}
@@ -1,11 +1,37 @@
 #include "slist.h"
+#include "slist_parallel.h"
+#include <csignal>
 #include <cstdlib>
-#include <fstream>
+#include <cstring>
 #include <iostream>
 
 namespace
 {
     bool should_execute = false;
+
+    // Worker threads of the parallel builtins: 0 runs them sequentially,
+    // -1 uses one thread per hardware thread
+    int thread_count = -1;
+    std::shared_ptr<slist::thread_pool> pool;
+
+    // Image loaded before evaluating, and image written after
+    std::string load_image_path;
+    std::string dump_image_path;
+
+    // Parse trees of the script files are cached there, if not empty
+    std::string cache_dir;
+
+    // Limits of each evaluation, 0 for none
+    size_t fuel_limit = 0;
+    long time_limit_ms = 0;
+
+    // Context interrupted by Ctrl-C in the interactive interpreter
+    slist::context *interactive_ctx = nullptr;
+    void on_interrupt(int);
+
+    bool prepare_context(slist::context& ctx);
+    bool finish_context(slist::context& ctx);
+
     void repl();
     std::vector<std::string> parse_arguments(int argc, char **argv);
 }
@@ -16,6 +42,15 @@ int main(int argc, char **argv)
 
     auto trailing = parse_arguments(argc, argv);
 
+    // Unsynchronized with stdio, std::cin reads what a pipe has available
+    // in one call instead of a character at a time
+    std::ios::sync_with_stdio(false);
+
+    if (thread_count != 0)
+    {
+        pool = std::make_shared<thread_pool>(thread_count > 0 ? thread_count : 0);
+    }
+
     if (trailing.empty()) 
     {
         repl();
@@ -26,35 +61,80 @@ int main(int argc, char **argv)
         {
             node_ptr n = parse(trailing[0]);
 
-            if (get_log_level() >= log_level::trace)
+            if (is_log_enabled(log_level::trace))
             {
-                LOG_TRACELN("");
+                log_traceln_slow();
                 debug_print_node(n);
-                LOG_TRACELN("");
+                log_traceln_slow();
             }
 
             context ctx;
-            while (n != nullptr)
+            if (!prepare_context(ctx))
+            {
+                return -1;
+            }
+
+            try
             {
-                auto r = eval(ctx, n->car);
-                if (r != nullptr)
+                while (n != nullptr)
                 {
-                    outputln("", r);
+                    auto r = eval(ctx, n->car);
+                    if (r != nullptr)
+                    {
+                        outputln("", r);
+                    }
+                    n = n->cdr;
                 }
-                n = n->cdr;
+            }
+            catch (const std::exception& e)
+            {
+                log_errorln(e.what());
+                return -1;
+            }
+
+            if (!finish_context(ctx))
+            {
+                return -1;
             }
         }
         else 
         {
-            std::ifstream in(trailing[0]);
-            if (in)
+            // '-' reads the forms from the standard input as they come
+            bool is_stdin = (trailing[0] == "-");
+            mapped_file file;
+            if (is_stdin || file.open(trailing[0], file_access::sequential))
             {
                 context ctx;
-                exec(ctx, in);
+                if (!prepare_context(ctx))
+                {
+                    return -1;
+                }
+
+                try
+                {
+                    if (is_stdin)
+                    {
+                        exec(ctx, std::cin);
+                    }
+                    else
+                    {
+                        exec(ctx, file.data(), file.size());
+                    }
+                }
+                catch (const std::exception& e)
+                {
+                    log_errorln(e.what());
+                    return -1;
+                }
+
+                if (!finish_context(ctx))
+                {
+                    return -1;
+                }
             }
             else 
             {
-                log_errorln("Invalid input file: " + trailing[0]);
+                log_errorln("Invalid input file: ", trailing[0]);
                 return -1;
             }            
         }
@@ -70,16 +150,50 @@ int main(int argc, char **argv)
 
 namespace
 {
+    bool prepare_context(slist::context& ctx)
+    {
+        ctx.pool = pool;
+        ctx.parse_cache_dir = cache_dir;
+        ctx.fuel_limit = fuel_limit;
+        ctx.time_limit = std::chrono::milliseconds(time_limit_ms);
+        if (ctx.log.level >= slist::log_level::trace)
+        {
+            ctx.observer = std::make_shared<slist::trace_observer>();
+        }
+        return load_image_path.empty() || slist::load_image(ctx, load_image_path);
+    }
+
+    bool finish_context(slist::context& ctx)
+    {
+        return dump_image_path.empty() || slist::dump_image(ctx, dump_image_path);
+    }
+
     void repl()
     {
         using namespace slist;
 
         context ctx;
+        if (!prepare_context(ctx))
+        {
+            return;
+        }
+
+        // Results show up as soon as they are printed
+        auto out = std::dynamic_pointer_cast<buffered_sink>(ctx.log.out);
+        if (out != nullptr)
+        {
+            out->set_line_buffered(true);
+        }
+
+        interactive_ctx = &ctx;
+        std::signal(SIGINT, &on_interrupt);
+
         std::string input;
 
         while (true)
         {
             output("> ");
+            flush_output();
             std::getline(std::cin, input);
 
             if (!std::cin)
@@ -88,16 +202,35 @@ namespace
             }
 
             auto n = parse(input);
-            while (n != nullptr)
+            try
             {
-                auto r = eval(ctx, n->car);
-                if (r != nullptr)
+                while (n != nullptr)
                 {
-                    outputln("", r);
+                    auto r = eval(ctx, n->car);
+                    if (r != nullptr)
+                    {
+                        outputln("", r);
+                    }
+                    n = n->cdr;
                 }
-                n = n->cdr;
+            }
+            catch (const std::exception& e)
+            {
+                // The context is still usable after an error
+                log_errorln(e.what());
             }
         }
+
+        std::signal(SIGINT, SIG_DFL);
+        interactive_ctx = nullptr;
+
+        finish_context(ctx);
+    }
+
+    void on_interrupt(int)
+    {
+        // Only sets an atomic flag, checked by the evaluator
+        interactive_ctx->interrupt();
     }
 
     std::vector<std::string> parse_arguments(int argc, char **argv)
@@ -127,6 +260,78 @@ namespace
                     log_error("Invalid argument to '-v'/'--log-level'\n");
                 }
             }
+            else if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0)
+            {
+                ++i;
+                if (i < argc && argv[i] != nullptr)
+                {
+                    thread_count = atoi(argv[i]);
+                }
+                else
+                {
+                    log_error("Invalid argument to '-j'/'--jobs'\n");
+                }
+            }
+            else if (strcmp(arg, "--load-image") == 0)
+            {
+                ++i;
+                if (i < argc && argv[i] != nullptr)
+                {
+                    load_image_path = argv[i];
+                }
+                else
+                {
+                    log_error("Invalid argument to '--load-image'\n");
+                }
+            }
+            else if (strcmp(arg, "--dump-image") == 0)
+            {
+                ++i;
+                if (i < argc && argv[i] != nullptr)
+                {
+                    dump_image_path = argv[i];
+                }
+                else
+                {
+                    log_error("Invalid argument to '--dump-image'\n");
+                }
+            }
+            else if (strcmp(arg, "--fuel") == 0)
+            {
+                ++i;
+                if (i < argc && argv[i] != nullptr)
+                {
+                    fuel_limit = strtoul(argv[i], nullptr, 10);
+                }
+                else
+                {
+                    log_error("Invalid argument to '--fuel'\n");
+                }
+            }
+            else if (strcmp(arg, "--timeout") == 0)
+            {
+                ++i;
+                if (i < argc && argv[i] != nullptr)
+                {
+                    time_limit_ms = atol(argv[i]);
+                }
+                else
+                {
+                    log_error("Invalid argument to '--timeout'\n");
+                }
+            }
+            else if (strcmp(arg, "--cache-dir") == 0)
+            {
+                ++i;
+                if (i < argc && argv[i] != nullptr)
+                {
+                    cache_dir = argv[i];
+                }
+                else
+                {
+                    log_error("Invalid argument to '--cache-dir'\n");
+                }
+            }
             else if (strcmp(arg, "-e") == 0 || strcmp(arg, "--exec") == 0)
             {
                 ++i;
@@ -146,7 +146,8 @@
         1
         (+ 1 (long-sum (- n 1)))))
 (run-test (= (long-sum 100) 100))
-;;(run-test (= (long-sum 1000) 1000)) ;; TODO: Need tail-call optimization
+(run-test (= (long-sum 5000) 5000)) ;; Deep non-tail recursion, does not use the C stack
+(run-test (= (length (make-list 1 5000)) 5000))
 
 (define (long-sum-2 n) ;; Tail-call optimized
     (letrec ((inner-sum (lambda (acc x) 
@@ -157,9 +158,36 @@
 
 (run-test (= (long-sum-2 10) 10))
 
+(define (mutual-even? n)
+    (letrec ((ev? (lambda (x) (if (= x 0) true (od? (- x 1)))))
+             (od? (lambda (x) (if (= x 0) false (ev? (- x 1))))))
+        (ev? n)))
+(run-test (mutual-even? 10000)) ;; Tail calls between different procedures
+
+(define (make-counter)
+    (let ((n 0))
+        (lambda () (begin (set! n (+ n 1)) n))))
+(define counter-1 (make-counter))
+(define counter-2 (make-counter))
+(counter-1)
+(run-test (= (counter-1) 2))
+(run-test (= (counter-2) 1))
+
+(define (collect-adders n acc) ;; Environments captured by closures are not reused
+    (if (= n 0)
+        acc
+        (collect-adders (- n 1) (cons (make-adder n) acc))))
+(define adders (collect-adders 50 '()))
+(run-test (= ((car adders) 10) 11))
+(run-test (= ((car (cdr adders)) 10) 12))
+
 ;; Symbols
 (run-test (eq? 'a 'a))
 (run-test (eq? 'a (quote a)))
+(run-test (equal? '(a (1 "b") true) (list 'a (list 1 "b") true)))
+(run-test (not (equal? 'a 'b)))
+(run-test (not (equal? true false)))
+(run-test (equal? car car))
 
 (define quote-a ''a)
 (run-test (not (eq? ''a quote-a)))
@@ -171,6 +199,13 @@
 (run-test (equal? (list 1 2 3) '(,one 2 3)))
 (run-test (equal? '((1 2)) '((,one 2))))
 
+(define (quoted-table) '(a (b c)))
+(run-test (eq? (quoted-table) (quoted-table))) ;; Quoted lists are constants
+(define (quoted-template x) '(a ,x (b c)))
+(run-test (equal? (quoted-template 1) '(a 1 (b c))))
+(run-test (not (eq? (quoted-template 1) (quoted-template 1))))
+(run-test (eq? (car (cdr (cdr (quoted-template 1)))) (car (cdr (cdr (quoted-template 2))))))
+
 (define some-string "hello")
 (run-test (equal? some-string "hello"))
 
@@ -201,3 +236,127 @@
     '(let ((v (lambda () ,a)))
         (v)))
 (run-test (= (let-test-macro-2 1) 1))
+
+;; Promises
+(define force-count 0)
+(define promise (delay (begin (set! force-count (+ force-count 1)) 42)))
+(run-test (promise? promise))
+(run-test (= (force promise) 42))
+(run-test (= (force promise) 42))
+(run-test (= force-count 1))
+(run-test (= (force (make-promise 5)) 5))
+(run-test (= (force 3) 3))
+
+;; Streams
+(define (integers-from n) (stream-cons n (integers-from (+ n 1))))
+(define (stream-ref s n)
+    (if (= n 0)
+        (stream-car s)
+        (stream-ref (stream-cdr s) (- n 1))))
+(run-test (equal? (stream-take (integers-from 0) 3) '(0 1 2)))
+(run-test (equal? (stream-take (stream-map (lambda (x) (* x x)) (integers-from 1)) 3) '(1 4 9)))
+(run-test (equal? (stream-take (stream-filter (lambda (x) (= (% x 7) 0)) (integers-from 1)) 3) '(7 14 21)))
+(run-test (= (stream-ref (integers-from 0) 10000) 10000)) ;; Runs in constant space
+(run-test (equal? (stream-take (stream-filter (lambda (x) (= (% x 100000) 0)) (integers-from 1)) 2) '(100000 200000))) ;; Skipped items are released
+(run-test (equal? (stream-take (apply stream-filter (list (lambda (x) (> x 2)) (integers-from 1))) 2) '(3 4)))
+
+;; Memoization
+(define memo-fib
+    (memoize (lambda (n)
+        (if (< n 2)
+            n
+            (+ (memo-fib (- n 1)) (memo-fib (- n 2)))))))
+(run-test (= (memo-fib 30) 832040))
+(run-test (equal? (memoize-stats memo-fib) '(28 31 31))) ;; (hits misses size)
+
+(define memo-square (memoize (lambda (x) (* x x)) 2))
+(memo-square 1)
+(memo-square 2)
+(memo-square 3) ;; Evicts 1
+(run-test (= (memo-square 1) 1))
+(run-test (equal? (memoize-stats memo-square) '(0 4 2)))
+
+(define memo-length (memoize length))
+(memo-length '(1 a "b" true))
+(memo-length (list 1 'a "b" true))
+(run-test (equal? (memoize-stats memo-length) '(1 1 1)))
+
+(define memo-first (memoize car))
+(define memo-key (list-copy '(1 2 3)))
+(memo-first memo-key)
+(reverse! memo-key) ;; Leaves the stored key unchanged
+(run-test (= (memo-first (list 1 2 3)) 1))
+(run-test (equal? (memoize-stats memo-first) '(1 1 1)))
+
+;; Destructive lists
+(define to-reverse (list-copy '(1 2 3)))
+(run-test (equal? (reverse! to-reverse) '(3 2 1)))
+(run-test (equal? to-reverse '(1)))
+(run-test (empty? (reverse! '())))
+(run-test (equal? (append! (list-copy '(1 2)) '() (list-copy '(3)) '(4 5)) '(1 2 3 4 5)))
+(run-test (empty? (append!)))
+(define to-copy '(1 2 3))
+(define copied (list-copy to-copy))
+(run-test (equal? copied to-copy))
+(run-test (not (eq? copied to-copy)))
+(run-test (= (length (reverse! (make-list 1 5000))) 5000))
+(define (quoted-list) '(1 2 3))
+(run-test (empty? (reverse! (quoted-list)))) ;; Quoted lists are constants
+(append! (list 0) (quoted-list) (list 4))
+(run-test (equal? (quoted-list) '(1 2 3)))
+(run-test (equal? (reverse! (list-copy (quoted-list))) '(3 2 1)))
+
+;; Parallel builtins
+(define (square x) (* x x))
+(define (count-up n acc)
+    (if (= n 0)
+        acc
+        (count-up (- n 1) (cons n acc))))
+(define numbers (count-up 1000 '()))
+(run-test (equal? (pmap square '(1 2 3 4)) '(1 4 9 16)))
+(run-test (empty? (pmap square (list))))
+(run-test (= (length (pmap square numbers)) 1000))
+(run-test (= (car (cdr (pmap square numbers))) 4))
+(run-test (let ((offset 10)) (equal? (pmap (lambda (x) (+ x offset)) '(1 2 3)) '(11 12 13))))
+(run-test (= (preduce + 0 numbers) 500500))
+(run-test (= (preduce + 5 (list)) 5))
+(run-test (equal? (pmap (lambda (x) (pmap square (list x x))) '(1 2)) '((1 1) (4 4))))
+(pfor-each square numbers)
+(run-test (equal? (pmap (lambda (x) (eq? x 'a)) '(a b a b)) (list (eq? 'a 'a) (eq? 'b 'a) (eq? 'a 'a) (eq? 'b 'a))))
+(run-test (equal? (pmap symbol? '(a b)) (list (symbol? 'a) (symbol? 'b))))
+(define pmap-symbols (pmap (lambda (x) 'first-quoted-by-pmap) '(1 2 3 4)))
+(run-test (equal? (pmap (lambda (s) (eq? s 'first-quoted-by-pmap)) pmap-symbols) '(true true true true)))
+(define pmap-promise (delay (* 6 7)))
+(run-test (equal? (pmap (lambda (x) (+ x (force pmap-promise))) '(1 2 3 4)) '(43 44 45 46)))
+(define pmap-stream (integers-from 0))
+(run-test (equal? (pmap (lambda (n) (stream-ref pmap-stream n)) '(300 200 300 100)) '(300 200 300 100)))
+(define memo-pmap-square (memoize square 8))
+(run-test (= (preduce + 0 (pmap memo-pmap-square numbers)) 333833500))
+(run-test (equal? (pmap memo-pmap-square '(1 2 3 1 2 3)) '(1 4 9 1 4 9)))
+
+;; Shadowed special forms
+(run-test (= (if true 1 2) 1))
+(run-test (= ((lambda (if) (if 1 2 3)) (lambda (a b c) b)) 2))
+(run-test (= (let ((begin (lambda (x) (* x 10)))) (begin 4)) 40))
+(run-test (= (begin 1 4) 4))
+(define (quote-twice quote) (list quote quote))
+(run-test (equal? (quote-twice 1) '(1 1)))
+
+;; Reader
+(run-test (= (length '(a "b) \"c" d)) 3))
+(run-test (equal? '(a ; b)
+                    c) '(a c)))
+(run-test (= (car (car (car (car (car '(((((1)))))))))) 1))
+
+;; Serialization
+(run-test (equal? (deserialize (serialize '(1 -7 2.5 "a \"b\"" sym (nested (deep)) #t))) '(1 -7 2.5 "a \"b\"" sym (nested (deep)) #t)))
+(run-test (eq? (car (deserialize (serialize '(sym)))) 'sym))
+(run-test (equal? (write-string (deserialize (serialize '(-0.5 -0.0 0.125 (a . b) () 1.5e3)))) "(-0.5 -0.0 0.125 (a . b) () 1.5e3)"))
+(run-test (let ((shared '(1 2))) (let ((d (deserialize (serialize (list shared shared))))) (eq? (car d) (car (cdr d))))))
+
+;; Printer
+(run-test (equal? (to-string '(a "b" (c . d))) "(a b (c . d))"))
+(run-test (equal? (write-string '(a "b")) "(a \"b\")"))
+(run-test (equal? (write-string (list "a\"b" "c\\d")) "(\"a\\\"b\" \"c\\\\d\")"))
+(run-test (equal? (to-string (list "a\"b" "c\\d" "e\f")) "(a\"b c\\d e\f)"))
+(run-test (let ((d (list 5 6))) (begin (append! d (list d)) (equal? (write-string d) "#0=(5 6 #0#)"))))